@@ -0,0 +1,234 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*-
+ *
+ * Copyright (c) Ryan O'Hara (rohara@redhat.com)
+ * Copyright (c) Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef _FENCE_KDUMP_ADDR_H
+#define _FENCE_KDUMP_ADDR_H
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#define FENCE_KDUMP_ADDRSET_MIN 16
+
+/*
+ * Binary address key. IPv4 addresses are stored in their IPv4-mapped
+ * IPv6 form so that a sender is matched the same way whether it reached
+ * us over an AF_INET socket or as a v4-mapped address on AF_INET6.
+ */
+typedef struct fence_kdump_addr {
+    uint8_t bytes[16];
+} fence_kdump_addr_t;
+
+typedef struct fence_kdump_addr_entry {
+    fence_kdump_addr_t addr;
+    void *data;
+} fence_kdump_addr_entry_t;
+
+/*
+ * Open-addressed hash table of address keys. The size is always a
+ * power of two and kept at least twice the number of entries.
+ */
+typedef struct fence_kdump_addrset {
+    unsigned int size;
+    unsigned int count;
+    fence_kdump_addr_entry_t *entry;
+} fence_kdump_addrset_t;
+
+static inline int
+set_addr (fence_kdump_addr_t *addr, const struct sockaddr *sa)
+{
+    const struct sockaddr_in *sin;
+    const struct sockaddr_in6 *sin6;
+
+    switch (sa->sa_family) {
+    case AF_INET:
+        sin = (const struct sockaddr_in *) sa;
+        memset (addr->bytes, 0, 10);
+        addr->bytes[10] = 0xff;
+        addr->bytes[11] = 0xff;
+        memcpy (&addr->bytes[12], &sin->sin_addr, 4);
+        return (0);
+    case AF_INET6:
+        sin6 = (const struct sockaddr_in6 *) sa;
+        memcpy (addr->bytes, &sin6->sin6_addr, 16);
+        return (0);
+    default:
+        return (-1);
+    }
+}
+
+static inline uint16_t
+get_port (const struct sockaddr *sa)
+{
+    switch (sa->sa_family) {
+    case AF_INET:
+        return (ntohs (((const struct sockaddr_in *) sa)->sin_port));
+    case AF_INET6:
+        return (ntohs (((const struct sockaddr_in6 *) sa)->sin6_port));
+    default:
+        return (0);
+    }
+}
+
+static inline int
+parse_addr (fence_kdump_addr_t *addr, const char *str)
+{
+    if (inet_pton (AF_INET, str, &addr->bytes[12]) == 1) {
+        memset (addr->bytes, 0, 10);
+        addr->bytes[10] = 0xff;
+        addr->bytes[11] = 0xff;
+        return (0);
+    }
+
+    if (inet_pton (AF_INET6, str, addr->bytes) == 1) {
+        return (0);
+    }
+
+    return (-1);
+}
+
+static inline int
+is_addr_v4mapped (const fence_kdump_addr_t *addr)
+{
+    static const uint8_t prefix[12] = {
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff
+    };
+
+    return (memcmp (addr->bytes, prefix, sizeof (prefix)) == 0);
+}
+
+static inline const char *
+print_addr (const fence_kdump_addr_t *addr, char *buf, size_t len)
+{
+    if (is_addr_v4mapped (addr)) {
+        return (inet_ntop (AF_INET, &addr->bytes[12], buf, len));
+    } else {
+        return (inet_ntop (AF_INET6, addr->bytes, buf, len));
+    }
+}
+
+static inline uint32_t
+hash_addr (const fence_kdump_addr_t *addr)
+{
+    int i;
+    uint32_t word;
+    uint32_t hash = 0;
+
+    for (i = 0; i < 16; i += 4) {
+        memcpy (&word, &addr->bytes[i], sizeof (word));
+        hash = (hash ^ word) * 0x9E3779B1;
+    }
+
+    return (hash ^ (hash >> 16));
+}
+
+static inline void
+init_addrset (fence_kdump_addrset_t *set)
+{
+    set->size = 0;
+    set->count = 0;
+    set->entry = NULL;
+}
+
+static inline void
+free_addrset (fence_kdump_addrset_t *set)
+{
+    free (set->entry);
+    init_addrset (set);
+}
+
+static inline fence_kdump_addr_entry_t *
+find_addrset_entry (const fence_kdump_addrset_t *set, const fence_kdump_addr_t *addr)
+{
+    unsigned int i;
+    fence_kdump_addr_entry_t *entry;
+
+    for (i = hash_addr (addr) & (set->size - 1);; i = (i + 1) & (set->size - 1)) {
+        entry = &set->entry[i];
+        if ((entry->data == NULL) ||
+            (memcmp (&entry->addr, addr, sizeof (*addr)) == 0)) {
+            return (entry);
+        }
+    }
+}
+
+static inline void *
+lookup_addrset (const fence_kdump_addrset_t *set, const fence_kdump_addr_t *addr)
+{
+    if (set->count == 0) {
+        return (NULL);
+    }
+
+    return (find_addrset_entry (set, addr)->data);
+}
+
+static inline int
+grow_addrset (fence_kdump_addrset_t *set)
+{
+    unsigned int i;
+    fence_kdump_addrset_t new;
+
+    new.size = (set->size != 0) ? (set->size * 2) : FENCE_KDUMP_ADDRSET_MIN;
+    new.count = set->count;
+    new.entry = calloc (new.size, sizeof (fence_kdump_addr_entry_t));
+    if (!new.entry) {
+        return (-1);
+    }
+
+    for (i = 0; i < set->size; i++) {
+        if (set->entry[i].data != NULL) {
+            *find_addrset_entry (&new, &set->entry[i].addr) = set->entry[i];
+        }
+    }
+
+    free (set->entry);
+    *set = new;
+
+    return (0);
+}
+
+/*
+ * Returns 1 if the address was added, 0 if it was already present
+ * (the existing entry is kept) and -1 on allocation failure.
+ */
+static inline int
+add_addrset (fence_kdump_addrset_t *set, const fence_kdump_addr_t *addr, void *data)
+{
+    fence_kdump_addr_entry_t *entry;
+
+    if ((set->count + 1) * 2 > set->size) {
+        if (grow_addrset (set) != 0) {
+            return (-1);
+        }
+    }
+
+    entry = find_addrset_entry (set, addr);
+    if (entry->data != NULL) {
+        return (0);
+    }
+
+    entry->addr = *addr;
+    entry->data = data;
+    set->count++;
+
+    return (1);
+}
+
+#endif /* _FENCE_KDUMP_ADDR_H */
@@ -0,0 +1,128 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*-
+ *
+ * Copyright (c) Ryan O'Hara (rohara@redhat.com)
+ * Copyright (c) Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef _FENCE_KDUMP_EVENT_H
+#define _FENCE_KDUMP_EVENT_H
+
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+#define FENCE_KDUMP_MAX_EVENTS 16
+
+/*
+ * Event loop built on epoll. The deadline is kept in a timerfd armed
+ * with an absolute CLOCK_MONOTONIC expiry, so it is registered like any
+ * other descriptor and is not shortened or reset by wakeups for
+ * packets that end up being discarded.
+ */
+typedef struct fence_kdump_event {
+    int epoll;
+    int timer;
+} fence_kdump_event_t;
+
+static inline void
+free_event (fence_kdump_event_t *ev)
+{
+    if (ev->timer >= 0) {
+        close (ev->timer);
+    }
+    if (ev->epoll >= 0) {
+        close (ev->epoll);
+    }
+
+    ev->timer = -1;
+    ev->epoll = -1;
+}
+
+static inline int
+add_event (fence_kdump_event_t *ev, int fd)
+{
+    struct epoll_event event;
+
+    memset (&event, 0, sizeof (event));
+
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+
+    return (epoll_ctl (ev->epoll, EPOLL_CTL_ADD, fd, &event));
+}
+
+static inline int
+init_event (fence_kdump_event_t *ev)
+{
+    ev->epoll = epoll_create1 (EPOLL_CLOEXEC);
+    ev->timer = timerfd_create (CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+    if ((ev->epoll < 0) || (ev->timer < 0) || (add_event (ev, ev->timer) != 0)) {
+        free_event (ev);
+        return (-1);
+    }
+
+    return (0);
+}
+
+static inline int
+set_event_deadline (fence_kdump_event_t *ev, int seconds)
+{
+    struct itimerspec its;
+
+    memset (&its, 0, sizeof (its));
+
+    if (clock_gettime (CLOCK_MONOTONIC, &its.it_value) != 0) {
+        return (-1);
+    }
+
+    its.it_value.tv_sec += seconds;
+
+    return (timerfd_settime (ev->timer, TFD_TIMER_ABSTIME, &its, NULL));
+}
+
+/* disarms the timer, which also drops an expiry not yet read */
+static inline int
+clear_event_deadline (fence_kdump_event_t *ev)
+{
+    struct itimerspec its;
+
+    memset (&its, 0, sizeof (its));
+
+    return (timerfd_settime (ev->timer, 0, &its, NULL));
+}
+
+static inline int
+is_event_deadline (const fence_kdump_event_t *ev, const struct epoll_event *event)
+{
+    return (event->data.fd == ev->timer);
+}
+
+static inline int
+wait_event (fence_kdump_event_t *ev, struct epoll_event *events, int max)
+{
+    int error;
+
+    do {
+        error = epoll_wait (ev->epoll, events, max, -1);
+    } while ((error < 0) && (errno == EINTR));
+
+    return (error);
+}
+
+#endif /* _FENCE_KDUMP_EVENT_H */
@@ -24,332 +24,2342 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <string.h>
-#include <getopt.h>
 #include <unistd.h>
 #include <syslog.h>
-#include <ctype.h>
 #include <errno.h>
 #include <netdb.h>
 #include <sys/types.h>
+#include <signal.h>
 #include <sys/socket.h>
+#include <sys/signalfd.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
 
 #include "options.h"
+#include "fence_opts.h"
+#include "event.h"
+#include "filter.h"
+#include "log.h"
 #include "message.h"
+#include "output.h"
+#include "seen.h"
 #include "version.h"
 
 static int verbose = 0;
 
-#define log_debug(lvl, fmt, args...)               \
-do {                                               \
-    if (lvl <= verbose) {                          \
-        fprintf (stdout, "[debug]: " fmt, ##args); \
-        syslog (LOG_INFO, fmt, ##args);            \
-    }                                              \
+#define FENCE_KDUMP_MAX_RECORDS    1024
+#define FENCE_KDUMP_QUERY_LEN      1024
+#define FENCE_KDUMP_QUERY_INTERVAL 100
+#define FENCE_KDUMP_POLICY_LEN     64
+#define FENCE_KDUMP_LATENCY_LEN    64
+
+/* "off" exit status when only some of the nodes were confirmed */
+#define FENCE_KDUMP_EXIT_PARTIAL   3
+
+/* first descriptor passed by systemd socket activation */
+#define FENCE_KDUMP_LISTEN_FDS_START 3
+
+/*
+ * Receive buffers for recvmmsg(). Each slot is set up once and re-used
+ * for every batch, so draining the socket does not allocate.
+ */
+typedef struct fence_kdump_batch {
+    fence_kdump_msg_buf_t msg[FENCE_KDUMP_BATCH];
+    struct sockaddr_storage addr[FENCE_KDUMP_BATCH];
+    struct iovec iov[FENCE_KDUMP_BATCH];
+    struct mmsghdr hdr[FENCE_KDUMP_BATCH];
+    char control[FENCE_KDUMP_BATCH][CMSG_SPACE (sizeof (struct timespec))];
+} fence_kdump_batch_t;
+
+/*
+ * Messages go through the log queue (see log.c). Level 0 messages are
+ * the verdicts and are never rate limited; messages at higher levels
+ * are limited per call site, since a packet flood would repeat them.
+ */
+#define log_debug(lvl, fmt, args...)                                    \
+do {                                                                    \
+    static fence_kdump_ratelimit_t _rl;                                 \
+    if (lvl <= verbose) {                                               \
+        log_queue (LOG_INFO, (lvl > 0) ? &_rl : NULL, fmt, ##args);     \
+    }                                                                   \
+} while (0);
+
+#define log_error(lvl, fmt, args...)                                    \
+do {                                                                    \
+    static fence_kdump_ratelimit_t _rl;                                 \
+    if (lvl <= verbose) {                                               \
+        log_queue (LOG_ERR, (lvl > 0) ? &_rl : NULL, fmt, ##args);      \
+    }                                                                   \
 } while (0);
 
-#define log_error(lvl, fmt, args...)               \
-do {                                               \
-    if (lvl <= verbose) {                          \
-        fprintf (stderr, "[error]: " fmt, ##args); \
-        syslog (LOG_ERR, fmt, ##args);             \
-    }                                              \
-} while (0);
+static void
+init_batch (fence_kdump_batch_t *batch)
+{
+    int i;
+
+    memset (batch, 0, sizeof (*batch));
+
+    for (i = 0; i < FENCE_KDUMP_BATCH; i++) {
+        batch->iov[i].iov_base = &batch->msg[i];
+        batch->iov[i].iov_len = sizeof (batch->msg[i]);
+
+        batch->hdr[i].msg_hdr.msg_name = &batch->addr[i];
+        batch->hdr[i].msg_hdr.msg_iov = &batch->iov[i];
+        batch->hdr[i].msg_hdr.msg_iovlen = 1;
+        batch->hdr[i].msg_hdr.msg_control = batch->control[i];
+    }
+}
+
+static int
+read_batch (int sock, fence_kdump_batch_t *batch)
+{
+    int i;
+    int error;
+
+    for (i = 0; i < FENCE_KDUMP_BATCH; i++) {
+        batch->hdr[i].msg_hdr.msg_namelen = sizeof (batch->addr[i]);
+        batch->hdr[i].msg_hdr.msg_controllen = sizeof (batch->control[i]);
+        batch->hdr[i].msg_hdr.msg_flags = 0;
+    }
+
+    error = recvmmsg (sock, batch->hdr, FENCE_KDUMP_BATCH, MSG_DONTWAIT, NULL);
+    if (error < 0) {
+        if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+            log_error (2, "recvmmsg (%s)\n", strerror (errno));
+        }
+    }
+
+    return (error);
+}
+
+/*
+ * Kernel receive timestamp of a message, zero if the socket did not
+ * provide one.
+ */
+static void
+get_rx_time (const struct msghdr *hdr, struct timespec *rx)
+{
+    struct cmsghdr *cmsg;
+
+    memset (rx, 0, sizeof (*rx));
+
+    for (cmsg = CMSG_FIRSTHDR ((struct msghdr *) hdr); cmsg != NULL;
+         cmsg = CMSG_NXTHDR ((struct msghdr *) hdr, cmsg)) {
+        if ((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_TIMESTAMPNS)) {
+            memcpy (rx, CMSG_DATA (cmsg), sizeof (*rx));
+        }
+    }
+}
+
+static int
+read_message (const struct mmsghdr *hdr, fence_kdump_addr_t *addr, uint16_t *port,
+              struct timespec *rx)
+{
+    get_rx_time (&hdr->msg_hdr, rx);
+
+    if (set_addr (addr, hdr->msg_hdr.msg_name) != 0) {
+        log_debug (1, "unsupported address family\n");
+        memset (addr, 0, sizeof (*addr));
+    }
+
+    *port = get_port (hdr->msg_hdr.msg_name);
+
+    if ((hdr->msg_len < sizeof (fence_kdump_msg_t)) ||
+        (hdr->msg_hdr.msg_flags & MSG_TRUNC)) {
+        log_debug (1, "invalid message size '%u'\n", hdr->msg_len);
+        return (FENCE_KDUMP_VERDICT_SIZE);
+    }
+
+    return (FENCE_KDUMP_VERDICT_ACCEPT);
+}
+
+static void
+log_progress (const char *from, const fence_kdump_progress_t *progress)
+{
+    log_debug (1, "'%s' stage '%s' written %llu of %llu bytes\n",
+               from, stage_name (progress->stage),
+               (unsigned long long) progress->written,
+               (unsigned long long) progress->total);
+}
+
+/* "key=value" fields for whichever latencies are known */
+static const char *
+print_latency (const fence_kdump_latency_t *latency, char *buf, size_t len)
+{
+    int n = 0;
+
+    buf[0] = 0;
+
+    if ((latency->flags & FENCE_KDUMP_LATENCY_WIRE) != 0) {
+        n = snprintf (buf, len, " wire_ns=%lld", (long long) latency->wire);
+    }
+    if (((latency->flags & FENCE_KDUMP_LATENCY_SEND) != 0) && (n >= 0) && ((size_t) n < len)) {
+        snprintf (buf + n, len - n, " send_ns=%lld", (long long) latency->send);
+    }
+
+    return (buf);
+}
+
+static int64_t
+get_timespec_ns (const struct timespec *ts)
+{
+    return ((int64_t) ts->tv_sec * 1000000000LL + ts->tv_nsec);
+}
+
+/*
+ * Measures, at the moment a message is accepted, how long it waited
+ * since the kernel received it and since the sender stamped it.
+ */
+static void
+get_latency (fence_kdump_latency_t *latency, const fence_kdump_msg_buf_t *msg,
+             const struct timespec *rx, const char *from)
+{
+    struct timespec now;
+    char buf[FENCE_KDUMP_LATENCY_LEN];
+
+    clock_gettime (CLOCK_REALTIME, &now);
+
+    latency->flags = 0;
+
+    if (rx->tv_sec != 0) {
+        latency->wire = get_timespec_ns (&now) - get_timespec_ns (rx);
+        latency->flags |= FENCE_KDUMP_LATENCY_WIRE;
+    }
+
+    if (msg->v1.version == FENCE_KDUMP_MSGV2) {
+        latency->send = get_timespec_ns (&now) - (int64_t) be64toh (msg->v2.timestamp);
+        latency->flags |= FENCE_KDUMP_LATENCY_SEND;
+    }
+
+    log_debug (1, "'%s' latency%s\n", from, print_latency (latency, buf, sizeof (buf)));
+}
+
+/* what is known about a node that was seen dumping */
+static void
+add_node_output (fence_kdump_output_t *out, const fence_kdump_node_t *node)
+{
+    int percent;
+
+    add_output_time (out, "last", &node->last);
+    add_output_str (out, "stage", stage_name (node->progress.stage));
+    add_output_int (out, "written", (long long) node->progress.written);
+    add_output_int (out, "total", (long long) node->progress.total);
+
+    percent = progress_percent (&node->progress);
+    if (percent >= 0) {
+        add_output_int (out, "percent", percent);
+    }
+
+    if ((node->latency.flags & FENCE_KDUMP_LATENCY_WIRE) != 0) {
+        add_output_int (out, "wire_ns", (long long) node->latency.wire);
+    }
+    if ((node->latency.flags & FENCE_KDUMP_LATENCY_SEND) != 0) {
+        add_output_int (out, "send_ns", (long long) node->latency.send);
+    }
+}
+
+/*
+ * Reports the verdict on one node of "off" the moment it is reached,
+ * so the caller can go on with that node while others are waited for.
+ */
+static void
+print_verdict (const fence_kdump_opts_t *opts, const fence_kdump_node_t *node,
+               const char *verdict)
+{
+    struct timespec now;
+    fence_kdump_output_t out;
+
+    if ((opts->output == FENCE_KDUMP_OUTPUT_NONE) ||
+        (opts->action != FENCE_KDUMP_ACTION_OFF)) {
+        return;
+    }
+
+    clock_gettime (CLOCK_MONOTONIC, &now);
+
+    begin_output (&out, stdout, opts->output);
+    add_output_str (&out, "node", node->info->name);
+    add_output_str (&out, "addr", node->info->addr);
+    add_output_str (&out, "verdict", verdict);
+    add_output_int (&out, "elapsed_ns",
+                    (long long) (get_timespec_ns (&now) - get_timespec_ns (&opts->started)));
+    if (node->fenced != 0) {
+        add_node_output (&out, node);
+    }
+    end_output (&out);
+}
+
+static void
+mark_node (fence_kdump_opts_t *opts, fence_kdump_node_t *node)
+{
+    if (node->fenced == 0) {
+        log_debug (0, "received valid message from '%s'\n", node->info->addr);
+        node->fenced = 1;
+        opts->pending--;
+        print_verdict (opts, node, "fenced");
+    }
+}
+
+/*
+ * Reports the nodes no message was accepted from. Returns 0 if every
+ * node was confirmed, FENCE_KDUMP_EXIT_PARTIAL if only some were and
+ * 1 if none was.
+ */
+static int
+finish_off (fence_kdump_opts_t *opts, const char *verdict)
+{
+    fence_kdump_node_t *node;
+
+    for_each_node (node, &opts->nodes) {
+        if (node->fenced == 0) {
+            log_debug (0, "no message from '%s'\n", node->info->addr);
+            print_verdict (opts, node, verdict);
+        }
+    }
+
+    if (opts->pending == 0) {
+        return (0);
+    }
+
+    return ((opts->pending < opts->nodes.count) ? FENCE_KDUMP_EXIT_PARTIAL : 1);
+}
+
+static int
+match_identity (const char *name, const char *id)
+{
+    size_t len;
+    struct in6_addr in;
+
+    /* nodes given by address have no name to compare with */
+    if ((inet_pton (AF_INET, name, &in) == 1) ||
+        (inet_pton (AF_INET6, name, &in) == 1)) {
+        return (1);
+    }
+
+    if (strcasecmp (name, id) == 0) {
+        return (1);
+    }
+
+    len = strcspn (name, ".");
+
+    return ((len == strcspn (id, ".")) && (strncasecmp (name, id, len) == 0));
+}
+
+static void
+get_identity (const fence_kdump_msg_v2_t *msg, char *id)
+{
+    memcpy (id, msg->node, sizeof (msg->node));
+    id[sizeof (msg->node)] = 0;
+}
+
+/*
+ * Checks the digest, the timestamp and the sequence number of a
+ * version 2 message. The boot id and sequence number last accepted
+ * from the same sender are updated on success.
+ */
+static int
+check_message_v2 (const fence_kdump_msg_v2_t *msg, const hmac_ctx_t *hmac,
+                  uint8_t *boot_id, uint64_t *last, const char *from)
+{
+    uint64_t seq;
+    int64_t skew;
+    struct timespec now;
+
+    if (!verify_message_v2 (msg, hmac)) {
+        log_debug (1, "invalid message digest from '%s'\n", from);
+        return (FENCE_KDUMP_VERDICT_DIGEST);
+    }
+
+    clock_gettime (CLOCK_REALTIME, &now);
+
+    skew = (int64_t) now.tv_sec - (int64_t) (be64toh (msg->timestamp) / 1000000000ULL);
+    if ((skew > FENCE_KDUMP_MAX_SKEW) || (skew < -FENCE_KDUMP_MAX_SKEW)) {
+        log_debug (1, "stale message from '%s' (skew %lld seconds)\n",
+                   from, (long long) skew);
+        return (FENCE_KDUMP_VERDICT_STALE);
+    }
+
+    seq = be64toh (msg->seq);
+
+    if (memcmp (boot_id, msg->boot_id, FENCE_KDUMP_BOOT_ID_LEN) == 0) {
+        if (seq <= *last) {
+            log_debug (1, "replayed message from '%s' (seq %llu)\n",
+                       from, (unsigned long long) seq);
+            return (FENCE_KDUMP_VERDICT_REPLAY);
+        }
+    } else {
+        memcpy (boot_id, msg->boot_id, FENCE_KDUMP_BOOT_ID_LEN);
+    }
+
+    *last = seq;
+
+    return (FENCE_KDUMP_VERDICT_ACCEPT);
+}
+
+/*
+ * Checks that the message has a known version, the size that version
+ * requires, and is acceptable under the configured key policy.
+ * Returns the verdict.
+ */
+static int
+check_message_version (const fence_kdump_opts_t *opts,
+                       const fence_kdump_msg_buf_t *msg, size_t len)
+{
+    switch (msg->v1.version) {
+    case FENCE_KDUMP_MSGV1:
+        if (len != sizeof (msg->v1)) {
+            log_debug (1, "invalid message size '%zu'\n", len);
+            return (FENCE_KDUMP_VERDICT_SIZE);
+        }
+        if ((opts->keyed != 0) && (opts->allow_v1 == 0)) {
+            log_debug (1, "reject unauthenticated message\n");
+            return (FENCE_KDUMP_VERDICT_UNAUTH);
+        }
+        return (FENCE_KDUMP_VERDICT_ACCEPT);
+    case FENCE_KDUMP_MSGV2:
+        if (len != sizeof (msg->v2)) {
+            log_debug (1, "invalid message size '%zu'\n", len);
+            return (FENCE_KDUMP_VERDICT_SIZE);
+        }
+        return (FENCE_KDUMP_VERDICT_ACCEPT);
+    default:
+        log_debug (1, "invalid message version '0x%X'\n", msg->v1.version);
+        return (FENCE_KDUMP_VERDICT_VERSION);
+    }
+}
+
+static int
+check_message (fence_kdump_opts_t *opts, const fence_kdump_msg_buf_t *msg,
+               size_t len, const fence_kdump_addr_t *addr, const struct timespec *rx)
+{
+    fence_kdump_node_t *node;
+    char buf[INET6_ADDRSTRLEN];
+    char id[FENCE_KDUMP_NODE_ID_LEN + 1];
+    int verdict;
+
+    if (msg->v1.magic != FENCE_KDUMP_MAGIC) {
+        log_debug (1, "invalid magic number '0x%X'\n", msg->v1.magic);
+        return (FENCE_KDUMP_VERDICT_MAGIC);
+    }
+
+    node = lookup_addrset (&opts->addrs, addr);
+    if (node == NULL) {
+        if (verbose >= 1) {
+            log_debug (1, "discard message from '%s'\n",
+                       print_addr (addr, buf, sizeof (buf)));
+        }
+        return (FENCE_KDUMP_VERDICT_UNKNOWN);
+    }
+
+    verdict = check_message_version (opts, msg, len);
+    if (verdict != FENCE_KDUMP_VERDICT_ACCEPT) {
+        return (verdict);
+    }
+
+    if (msg->v1.version == FENCE_KDUMP_MSGV2) {
+        get_identity (&msg->v2, id);
+        if (!match_identity (node->info->name, id)) {
+            log_debug (1, "message from '%s' claims to be node '%s'\n", node->info->addr, id);
+            return (FENCE_KDUMP_VERDICT_IDENTITY);
+        }
+        verdict = check_message_v2 (&msg->v2, &opts->hmac,
+                                    node->boot_id, &node->seq, node->info->addr);
+        if (verdict != FENCE_KDUMP_VERDICT_ACCEPT) {
+            return (verdict);
+        }
+        get_progress (&msg->v2, &node->progress);
+        log_progress (node->info->addr, &node->progress);
+    }
+
+    if (node->fenced == 0) {
+        get_latency (&node->latency, msg, rx, node->info->addr);
+    }
+
+    clock_gettime (CLOCK_REALTIME, &node->last);
+
+    node->info->from = *addr;
+    if (msg->v1.version == FENCE_KDUMP_MSGV2) {
+        get_identity (&msg->v2, node->info->id);
+    } else {
+        node->info->id[0] = 0;
+    }
+
+    mark_node (opts, node);
+
+    return (FENCE_KDUMP_VERDICT_ACCEPT);
+}
+
+static void
+read_socket (fence_kdump_opts_t *opts, int sock, fence_kdump_batch_t *batch)
+{
+    int i;
+    int n;
+    int verdict;
+    uint16_t port;
+    fence_kdump_addr_t addr;
+    struct timespec rx;
+
+    /* a batch is received whole, so all of it goes to the journal */
+    do {
+        n = read_batch (sock, batch);
+
+        for (i = 0; i < n; i++) {
+            verdict = read_message (&batch->hdr[i], &addr, &port, &rx);
+            if (verdict == FENCE_KDUMP_VERDICT_ACCEPT) {
+                verdict = check_message (opts, &batch->msg[i], batch->hdr[i].msg_len,
+                                         &addr, &rx);
+            }
+            write_journal (&opts->journal, &addr, port, &batch->msg[i],
+                           batch->hdr[i].msg_len, verdict);
+        }
+    } while ((n == FENCE_KDUMP_BATCH) && (opts->pending > 0));
+}
+
+/*
+ * The ring counterpart of read_message(). The payload is copied out of
+ * the ring, where it is not aligned for the message fields.
+ */
+static int
+read_datagram (const fence_kdump_datagram_t *dgram, fence_kdump_msg_buf_t *msg,
+               size_t *len, fence_kdump_addr_t *addr, uint16_t *port, struct timespec *rx)
+{
+    *rx = dgram->rx;
+
+    if (set_addr (addr, (const struct sockaddr *) &dgram->from) != 0) {
+        log_debug (1, "unsupported address family\n");
+        memset (addr, 0, sizeof (*addr));
+    }
+
+    *port = get_port ((const struct sockaddr *) &dgram->from);
+
+    *len = (dgram->len < sizeof (*msg)) ? dgram->len : sizeof (*msg);
+    memcpy (msg, dgram->data, *len);
+
+    if ((*len < sizeof (fence_kdump_msg_t)) || (dgram->len > sizeof (*msg)) ||
+        (dgram->truncated != 0)) {
+        log_debug (1, "invalid message size '%zu'\n", dgram->len);
+        return (FENCE_KDUMP_VERDICT_SIZE);
+    }
+
+    return (FENCE_KDUMP_VERDICT_ACCEPT);
+}
+
+static void
+read_ring (fence_kdump_opts_t *opts)
+{
+    size_t len;
+    int verdict;
+    uint16_t port;
+    fence_kdump_addr_t addr;
+    fence_kdump_msg_buf_t msg;
+    fence_kdump_datagram_t dgram;
+    struct timespec rx;
+
+    while (next_datagram (&opts->ring, &dgram) != 0) {
+        verdict = read_datagram (&dgram, &msg, &len, &addr, &port, &rx);
+        if (verdict == FENCE_KDUMP_VERDICT_ACCEPT) {
+            verdict = check_message (opts, &msg, len, &addr, &rx);
+        }
+        write_journal (&opts->journal, &addr, port, &msg, len, verdict);
+    }
+}
+
+static int
+do_action_off (fence_kdump_opts_t *opts)
+{
+    int i;
+    int n = 0;
+    fence_kdump_event_t ev;
+    fence_kdump_node_t *node;
+    char buf[FENCE_KDUMP_LATENCY_LEN];
+    struct epoll_event events[FENCE_KDUMP_MAX_EVENTS];
+    static fence_kdump_batch_t batch;
+
+    if (opts->nodes.count == 0) {
+        return (1);
+    }
+
+    init_batch (&batch);
+
+    if (init_event (&ev) != 0) {
+        log_error (2, "init_event (%s)\n", strerror (errno));
+        return (1);
+    }
+
+    for (i = 0; i < opts->nsockets; i++) {
+        if (add_event (&ev, opts->sockets[i]) != 0) {
+            log_error (2, "epoll_ctl (%s)\n", strerror (errno));
+            free_event (&ev);
+            return (1);
+        }
+    }
+
+    if ((opts->ring.sock >= 0) && (add_event (&ev, opts->ring.sock) != 0)) {
+        log_error (2, "epoll_ctl (%s)\n", strerror (errno));
+        free_event (&ev);
+        return (1);
+    }
+
+    if (set_event_deadline (&ev, opts->timeout) != 0) {
+        log_error (2, "timerfd_settime (%s)\n", strerror (errno));
+        free_event (&ev);
+        return (1);
+    }
+
+    clock_gettime (CLOCK_MONOTONIC, &opts->started);
+
+    opts->pending = 0;
+    for_each_node (node, &opts->nodes) {
+        log_debug (0, "waiting for message from '%s'\n", node->info->addr);
+        opts->pending++;
+    }
+
+    while (opts->pending > 0) {
+        n = wait_event (&ev, events, FENCE_KDUMP_MAX_EVENTS);
+        if (n < 0) {
+            log_error (2, "epoll_wait (%s)\n", strerror (errno));
+            break;
+        }
+
+        /* what the ready sockets hold is journaled before leaving */
+        for (i = 0; i < n; i++) {
+            if (is_event_deadline (&ev, &events[i])) {
+                if (opts->pending > 0) {
+                    log_debug (0, "timeout after %d seconds\n", opts->timeout);
+                }
+                goto out;
+            } else if (events[i].data.fd == opts->ring.sock) {
+                read_ring (opts);
+            } else {
+                read_socket (opts, events[i].data.fd, &batch);
+            }
+        }
+    }
+
+out:
+    free_event (&ev);
+
+    for_each_node (node, &opts->nodes) {
+        if ((node->fenced != 0) && (node->latency.flags != 0)) {
+            log_debug (0, "latency node=%s%s\n", node->info->name,
+                       print_latency (&node->latency, buf, sizeof (buf)));
+        }
+    }
+
+    return (finish_off (opts, (n < 0) ? "error" : "timeout"));
+}
+
+/*
+ * Messages seen by the daemon, one record per sender address. The
+ * records are allocated once and indexed by an address set; when the
+ * table is full the record seen least recently is re-used.
+ */
+typedef struct fence_kdump_record {
+    fence_kdump_addr_t addr;
+    char node[FENCE_KDUMP_NODE_ID_LEN + 1];
+    uint8_t boot_id[FENCE_KDUMP_BOOT_ID_LEN];
+    uint64_t seq;
+    uint32_t version;
+    uint64_t count;
+    fence_kdump_progress_t progress;
+    struct timespec first;
+    struct timespec last;
+} fence_kdump_record_t;
+
+typedef struct fence_kdump_table {
+    fence_kdump_record_t *record;
+    int count;
+    int dirty;
+    fence_kdump_seen_t *seen;
+    fence_kdump_addrset_t addrs;
+} fence_kdump_table_t;
+
+static int
+index_table (fence_kdump_table_t *table)
+{
+    int i;
+
+    free_addrset (&table->addrs);
+
+    for (i = 0; i < table->count; i++) {
+        if (add_addrset (&table->addrs, &table->record[i].addr, &table->record[i]) < 0) {
+            return (-1);
+        }
+    }
+
+    return (0);
+}
+
+static fence_kdump_record_t *
+get_record (fence_kdump_table_t *table, const fence_kdump_addr_t *addr, int *created)
+{
+    int i;
+    fence_kdump_record_t *record;
+
+    record = lookup_addrset (&table->addrs, addr);
+    if (record != NULL) {
+        *created = 0;
+        return (record);
+    }
+
+    if (table->count < FENCE_KDUMP_MAX_RECORDS) {
+        record = &table->record[table->count++];
+        memset (record, 0, sizeof (*record));
+        record->addr = *addr;
+        if (add_addrset (&table->addrs, addr, record) < 0) {
+            table->count--;
+            return (NULL);
+        }
+    } else {
+        record = &table->record[0];
+        for (i = 1; i < table->count; i++) {
+            if (table->record[i].last.tv_sec < record->last.tv_sec) {
+                record = &table->record[i];
+            }
+        }
+        memset (record, 0, sizeof (*record));
+        record->addr = *addr;
+        if (index_table (table) != 0) {
+            return (NULL);
+        }
+    }
+
+    *created = 1;
+
+    return (record);
+}
+
+static int
+record_message (const fence_kdump_opts_t *opts, fence_kdump_table_t *table,
+                const fence_kdump_msg_buf_t *msg, size_t len,
+                const fence_kdump_addr_t *addr, const struct timespec *rx)
+{
+    int created;
+    int verdict;
+    uint8_t boot_id[FENCE_KDUMP_BOOT_ID_LEN];
+    uint64_t seq;
+    fence_kdump_record_t *record;
+    fence_kdump_latency_t latency;
+    char buf[INET6_ADDRSTRLEN];
+
+    if (msg->v1.magic != FENCE_KDUMP_MAGIC) {
+        log_debug (1, "invalid magic number '0x%X'\n", msg->v1.magic);
+        return (FENCE_KDUMP_VERDICT_MAGIC);
+    }
+
+    verdict = check_message_version (opts, msg, len);
+    if (verdict != FENCE_KDUMP_VERDICT_ACCEPT) {
+        return (verdict);
+    }
+
+    print_addr (addr, buf, sizeof (buf));
+
+    record = lookup_addrset (&table->addrs, addr);
+
+    if (msg->v1.version == FENCE_KDUMP_MSGV2) {
+        if (record != NULL) {
+            memcpy (boot_id, record->boot_id, sizeof (boot_id));
+            seq = record->seq;
+        } else {
+            memset (boot_id, 0, sizeof (boot_id));
+            seq = 0;
+        }
+        verdict = check_message_v2 (&msg->v2, &opts->hmac, boot_id, &seq, buf);
+        if (verdict != FENCE_KDUMP_VERDICT_ACCEPT) {
+            return (verdict);
+        }
+    }
+
+    if (verbose >= 1) {
+        get_latency (&latency, msg, rx, buf);
+    }
+
+    record = get_record (table, addr, &created);
+    if (record == NULL) {
+        log_error (2, "failed to record message from '%s'\n", buf);
+        return (FENCE_KDUMP_VERDICT_ACCEPT);
+    }
+
+    clock_gettime (CLOCK_REALTIME, &record->last);
+
+    if (created) {
+        record->first = record->last;
+    }
+
+    record->version = msg->v1.version;
+    record->count++;
+
+    if (msg->v1.version == FENCE_KDUMP_MSGV2) {
+        if (memcmp (record->boot_id, boot_id, sizeof (boot_id)) != 0) {
+            created = 1;
+        }
+        memcpy (record->boot_id, boot_id, sizeof (boot_id));
+        record->seq = seq;
+        get_identity (&msg->v2, record->node);
+        get_progress (&msg->v2, &record->progress);
+        log_progress (buf, &record->progress);
+    } else {
+        record->node[0] = 0;
+        memset (&record->progress, 0, sizeof (record->progress));
+    }
+
+    table->dirty = 1;
+
+    if (created) {
+        log_debug (0, "received valid message from '%s'\n", buf);
+    } else {
+        log_debug (1, "received valid message from '%s'\n", buf);
+    }
+
+    return (FENCE_KDUMP_VERDICT_ACCEPT);
+}
+
+static void
+read_socket_daemon (const fence_kdump_opts_t *opts, fence_kdump_table_t *table,
+                    int sock, fence_kdump_batch_t *batch)
+{
+    int i;
+    int n;
+    int verdict;
+    uint16_t port;
+    fence_kdump_addr_t addr;
+    struct timespec rx;
+
+    do {
+        n = read_batch (sock, batch);
+
+        for (i = 0; i < n; i++) {
+            verdict = read_message (&batch->hdr[i], &addr, &port, &rx);
+            if (verdict == FENCE_KDUMP_VERDICT_ACCEPT) {
+                verdict = record_message (opts, table, &batch->msg[i],
+                                          batch->hdr[i].msg_len, &addr, &rx);
+            }
+            write_journal (&opts->journal, &addr, port, &batch->msg[i],
+                           batch->hdr[i].msg_len, verdict);
+        }
+    } while (n == FENCE_KDUMP_BATCH);
+}
+
+static void
+read_ring_daemon (const fence_kdump_opts_t *opts, fence_kdump_table_t *table,
+                  fence_kdump_ring_t *ring)
+{
+    size_t len;
+    int verdict;
+    uint16_t port;
+    fence_kdump_addr_t addr;
+    fence_kdump_msg_buf_t msg;
+    fence_kdump_datagram_t dgram;
+    struct timespec rx;
+
+    while (next_datagram (ring, &dgram) != 0) {
+        verdict = read_datagram (&dgram, &msg, &len, &addr, &port, &rx);
+        if (verdict == FENCE_KDUMP_VERDICT_ACCEPT) {
+            verdict = record_message (opts, table, &msg, len, &addr, &rx);
+        }
+        write_journal (&opts->journal, &addr, port, &msg, len, verdict);
+    }
+}
+
+/*
+ * Starts from the last-seen table a previous daemon left, so a restart
+ * does not forget a node that is already dumping.
+ */
+static void
+load_seen_table (const fence_kdump_opts_t *opts, fence_kdump_table_t *table)
+{
+    int i;
+    int n;
+    int created;
+    fence_kdump_record_t *record;
+
+    n = read_seen_file (opts->seenpath, table->seen, FENCE_KDUMP_MAX_RECORDS);
+    if (n < 0) {
+        log_debug (1, "no last-seen table '%s' (%s)\n", opts->seenpath, strerror (errno));
+        return;
+    }
+
+    for (i = 0; i < n; i++) {
+        record = get_record (table, &table->seen[i].addr, &created);
+        if (record == NULL) {
+            break;
+        }
+        strcpy (record->node, table->seen[i].node);
+        record->version = (record->node[0] != 0) ? FENCE_KDUMP_MSGV2 : FENCE_KDUMP_MSGV1;
+        record->progress = table->seen[i].progress;
+        record->first = table->seen[i].last;
+        record->last = table->seen[i].last;
+        memcpy (record->boot_id, table->seen[i].boot_id, sizeof (record->boot_id));
+        record->seq = table->seen[i].seq;
+    }
+
+    log_debug (1, "loaded %d record(s) from '%s'\n", i, opts->seenpath);
+}
+
+static void
+save_seen_table (const fence_kdump_opts_t *opts, fence_kdump_table_t *table)
+{
+    int i;
+
+    for (i = 0; i < table->count; i++) {
+        table->seen[i].addr = table->record[i].addr;
+        strcpy (table->seen[i].node, table->record[i].node);
+        table->seen[i].last = table->record[i].last;
+        table->seen[i].progress = table->record[i].progress;
+        memcpy (table->seen[i].boot_id, table->record[i].boot_id,
+                sizeof (table->seen[i].boot_id));
+        table->seen[i].seq = table->record[i].seq;
+    }
+
+    if (write_seen_file (opts->seenpath, table->seen, table->count) != 0) {
+        log_error (1, "failed to write last-seen table '%s' (%s)\n",
+                   opts->seenpath, strerror (errno));
+    }
+
+    table->dirty = 0;
+}
+
+/*
+ * What an agent and the daemon must agree on for the daemon to answer
+ * for the agent: "<port> <key> <v1>", where <key> is a short digest
+ * made with the key, or "-" without one, and <v1> is 1 if version 1
+ * messages are accepted.
+ */
+static void
+print_policy (const fence_kdump_opts_t *opts, char *buf, size_t len)
+{
+    unsigned int i;
+    uint8_t digest[8];
+    char key[sizeof (digest) * 2 + 1] = "-";
+    static const char label[] = "fence_kdump policy";
+
+    if (opts->keyed != 0) {
+        hmac_digest (&opts->hmac, label, sizeof (label) - 1, digest, sizeof (digest));
+        for (i = 0; i < sizeof (digest); i++) {
+            sprintf (&key[i * 2], "%02x", digest[i]);
+        }
+    }
+
+    snprintf (buf, len, "%d %s %d", opts->ipport, key,
+              (opts->keyed == 0) || (opts->allow_v1 != 0));
+}
+
+/*
+ * Query: "SEEN <since> <name> <port> <key> <v1> <addr> [<addr>...]"
+ * Reply: "YES <seconds>.<nanoseconds> <stage> <written> <total>" for
+ *        the most recent message received from any of the addresses at
+ *        or after <since>, "NO" if there is none, or "ERR <reason>".
+ *        <port> <key> <v1> are the agent's policy, see print_policy();
+ *        a query whose policy is not the daemon's is refused.
+ *
+ * Query: "PING"
+ * Reply: "PONG"
+ *
+ * A query may start with a tag "@<tag> ", which is put in front of the
+ * reply, so that a reply that came too late is not taken for the
+ * reply to the next query.
+ */
+static void
+answer_query (const fence_kdump_table_t *table, const char *policy,
+              char *query, char *reply, size_t len)
+{
+    int i;
+    char *save;
+    char *word;
+    char *name;
+    char *agent[3];
+    char buf[FENCE_KDUMP_QUERY_LEN];
+    long long since;
+    fence_kdump_addr_t addr;
+    fence_kdump_record_t *record;
+    const fence_kdump_record_t *best = NULL;
+
+    word = strtok_r (query, " \t\n", &save);
+    if ((word != NULL) && (strcmp (word, "PING") == 0)) {
+        snprintf (reply, len, "PONG");
+        return;
+    }
+    if ((word == NULL) || (strcmp (word, "SEEN") != 0)) {
+        snprintf (reply, len, "ERR unknown query");
+        return;
+    }
+
+    word = strtok_r (NULL, " \t\n", &save);
+    name = strtok_r (NULL, " \t\n", &save);
+    for (i = 0; i < 3; i++) {
+        agent[i] = strtok_r (NULL, " \t\n", &save);
+    }
+    if ((word == NULL) || (name == NULL) || (agent[2] == NULL)) {
+        snprintf (reply, len, "ERR missing argument");
+        return;
+    }
+
+    /* messages the agent would have rejected must not count for it */
+    snprintf (buf, sizeof (buf), "%s %s %s", agent[0], agent[1], agent[2]);
+    if (strcmp (buf, policy) != 0) {
+        snprintf (reply, len, "ERR policy mismatch");
+        return;
+    }
+
+    since = strtoll (word, NULL, 10);
+
+    while ((word = strtok_r (NULL, " \t\n", &save)) != NULL) {
+        if (parse_addr (&addr, word) != 0) {
+            snprintf (reply, len, "ERR invalid address '%s'", word);
+            return;
+        }
+        record = lookup_addrset (&table->addrs, &addr);
+        if ((record == NULL) || (record->last.tv_sec < since)) {
+            continue;
+        }
+        if ((record->version == FENCE_KDUMP_MSGV2) && !match_identity (name, record->node)) {
+            continue;
+        }
+        if ((best == NULL) || (record->last.tv_sec > best->last.tv_sec)) {
+            best = record;
+        }
+    }
+
+    if (best != NULL) {
+        snprintf (reply, len, "YES %lld.%09ld %s %llu %llu",
+                  (long long) best->last.tv_sec, best->last.tv_nsec,
+                  stage_name (best->progress.stage),
+                  (unsigned long long) best->progress.written,
+                  (unsigned long long) best->progress.total);
+    } else {
+        snprintf (reply, len, "NO");
+    }
+}
+
+static void
+read_control (const fence_kdump_table_t *table, const char *policy, int sock)
+{
+    ssize_t n;
+    int tag;
+    char *body;
+    char query[FENCE_KDUMP_QUERY_LEN];
+    char reply[FENCE_KDUMP_QUERY_LEN];
+    struct sockaddr_un sun;
+    socklen_t size;
+
+    for (;;) {
+        size = sizeof (sun);
+        n = recvfrom (sock, query, sizeof (query) - 1, MSG_DONTWAIT,
+                      (struct sockaddr *) &sun, &size);
+        if (n < 0) {
+            if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+                log_error (2, "recvfrom (%s)\n", strerror (errno));
+            }
+            break;
+        }
+
+        query[n] = 0;
+
+        tag = 0;
+        body = query;
+        if (query[0] == '@') {
+            body += strcspn (query, " \t\n");
+            if (*body != 0) {
+                *body++ = 0;
+            }
+            tag = snprintf (reply, sizeof (reply), "%s ", query);
+            if ((size_t) tag >= sizeof (reply)) {
+                continue;
+            }
+        }
+
+        answer_query (table, policy, body, reply + tag, sizeof (reply) - tag);
+
+        if (sendto (sock, reply, strlen (reply), MSG_DONTWAIT,
+                    (struct sockaddr *) &sun, size) < 0) {
+            log_error (2, "sendto (%s)\n", strerror (errno));
+        }
+    }
+}
+
+static int
+open_control (fence_kdump_opts_t *opts)
+{
+    mode_t mask;
+    struct sockaddr_un sun;
+
+    /* systemd already bound the query socket */
+    if (opts->control >= 0) {
+        return (0);
+    }
+
+    if (strlen (opts->sockpath) >= sizeof (sun.sun_path)) {
+        log_error (0, "socket path '%s' too long\n", opts->sockpath);
+        return (1);
+    }
+
+    memset (&sun, 0, sizeof (sun));
+    sun.sun_family = AF_UNIX;
+    strcpy (sun.sun_path, opts->sockpath);
+
+    opts->control = socket (AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (opts->control < 0) {
+        log_error (2, "socket (%s)\n", strerror (errno));
+        return (1);
+    }
+
+    unlink (opts->sockpath);
+
+    mask = umask (077);
+    if (bind (opts->control, (struct sockaddr *) &sun, sizeof (sun)) != 0) {
+        log_error (2, "bind '%s' (%s)\n", opts->sockpath, strerror (errno));
+        umask (mask);
+        return (1);
+    }
+    umask (mask);
+
+    return (0);
+}
+
+static int
+do_action_daemon (fence_kdump_opts_t *opts)
+{
+    int i;
+    int n;
+    int sfd;
+    int error = 0;
+    int armed = 0;
+    sigset_t mask;
+    fence_kdump_event_t ev;
+    fence_kdump_table_t table;
+    struct epoll_event events[FENCE_KDUMP_MAX_EVENTS];
+    char policy[FENCE_KDUMP_POLICY_LEN];
+    static fence_kdump_batch_t batch;
+
+    if (open_control (opts) != 0) {
+        return (1);
+    }
+
+    print_policy (opts, policy, sizeof (policy));
+    log_debug (1, "answering queries for policy '%s'\n", policy);
+
+    sigemptyset (&mask);
+    sigaddset (&mask, SIGINT);
+    sigaddset (&mask, SIGTERM);
+    sigprocmask (SIG_BLOCK, &mask, NULL);
+
+    sfd = signalfd (-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (sfd < 0) {
+        log_error (2, "signalfd (%s)\n", strerror (errno));
+        return (1);
+    }
+
+    if (init_event (&ev) != 0) {
+        log_error (2, "init_event (%s)\n", strerror (errno));
+        close (sfd);
+        return (1);
+    }
+
+    if ((add_event (&ev, sfd) != 0) || (add_event (&ev, opts->control) != 0)) {
+        log_error (2, "epoll_ctl (%s)\n", strerror (errno));
+        error = 1;
+    }
+
+    for (i = 0; (i < opts->nsockets) && (error == 0); i++) {
+        if (add_event (&ev, opts->sockets[i]) != 0) {
+            log_error (2, "epoll_ctl (%s)\n", strerror (errno));
+            error = 1;
+        }
+    }
+
+    if ((opts->ring.sock >= 0) && (error == 0) && (add_event (&ev, opts->ring.sock) != 0)) {
+        log_error (2, "epoll_ctl (%s)\n", strerror (errno));
+        error = 1;
+    }
+
+    memset (&table, 0, sizeof (table));
+    init_addrset (&table.addrs);
+
+    table.record = calloc (FENCE_KDUMP_MAX_RECORDS, sizeof (fence_kdump_record_t));
+    if (!table.record) {
+        log_error (2, "calloc (%s)\n", strerror (errno));
+        error = 1;
+    }
+
+    if ((opts->seenpath != NULL) && (error == 0)) {
+        table.seen = calloc (FENCE_KDUMP_MAX_RECORDS, sizeof (fence_kdump_seen_t));
+        if (!table.seen) {
+            log_error (2, "calloc (%s)\n", strerror (errno));
+            error = 1;
+        } else {
+            load_seen_table (opts, &table);
+        }
+    }
+
+    init_batch (&batch);
+
+    if (error == 0) {
+        log_debug (0, "listening on port '%d', queries on '%s'\n",
+                   opts->ipport, opts->sockpath);
+    }
+
+    while (error == 0) {
+        n = wait_event (&ev, events, FENCE_KDUMP_MAX_EVENTS);
+        if (n < 0) {
+            log_error (2, "epoll_wait (%s)\n", strerror (errno));
+            error = 1;
+            break;
+        }
+
+        for (i = 0; i < n; i++) {
+            if (events[i].data.fd == sfd) {
+                log_debug (0, "exiting on signal\n");
+                goto out;
+            } else if (is_event_deadline (&ev, &events[i])) {
+                clear_event_deadline (&ev);
+                save_seen_table (opts, &table);
+                armed = 0;
+            } else if (events[i].data.fd == opts->control) {
+                read_control (&table, policy, opts->control);
+            } else if (events[i].data.fd == opts->ring.sock) {
+                read_ring_daemon (opts, &table, &opts->ring);
+            } else {
+                read_socket_daemon (opts, &table, events[i].data.fd, &batch);
+            }
+        }
+
+        /* a node sends every few seconds, write the table once for all */
+        if ((table.seen != NULL) && (table.dirty != 0) && (armed == 0)) {
+            if (set_event_deadline (&ev, FENCE_KDUMP_SEEN_INTERVAL) != 0) {
+                log_error (2, "timerfd_settime (%s)\n", strerror (errno));
+                save_seen_table (opts, &table);
+            } else {
+                armed = 1;
+            }
+        }
+    }
+
+out:
+    if (opts->activated == 0) {
+        unlink (opts->sockpath);
+    }
+
+    if ((table.seen != NULL) && (table.dirty != 0)) {
+        save_seen_table (opts, &table);
+    }
+
+    free_addrset (&table.addrs);
+    free (table.seen);
+    free (table.record);
+    free_event (&ev);
+    close (sfd);
+
+    return (error);
+}
+
+/*
+ * Returns a socket connected to a running daemon, or -1 if there is
+ * none and the agent has to listen itself.
+ */
+static int
+connect_control (const fence_kdump_opts_t *opts)
+{
+    int sock;
+    struct timeval tv;
+    struct sockaddr_un sun;
+
+    if (strlen (opts->sockpath) >= sizeof (sun.sun_path)) {
+        return (-1);
+    }
+
+    sock = socket (AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (sock < 0) {
+        return (-1);
+    }
+
+    /* an abstract autobound address lets the daemon reply */
+    memset (&sun, 0, sizeof (sun));
+    sun.sun_family = AF_UNIX;
+
+    if (bind (sock, (struct sockaddr *) &sun, sizeof (sa_family_t)) != 0) {
+        close (sock);
+        return (-1);
+    }
+
+    strcpy (sun.sun_path, opts->sockpath);
+
+    if (connect (sock, (struct sockaddr *) &sun, sizeof (sun)) != 0) {
+        log_debug (1, "no daemon on '%s' (%s)\n", opts->sockpath, strerror (errno));
+        close (sock);
+        return (-1);
+    }
+
+    tv.tv_sec = 1;
+    tv.tv_usec = 0;
+    setsockopt (sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof (tv));
+
+    return (sock);
+}
+
+/*
+ * Sends a query to the daemon and waits for its reply. Each query is
+ * tagged, and a reply with another tag, left over from a query that
+ * timed out, is dropped. Returns the length of the reply, with the tag
+ * removed, or -1.
+ */
+static ssize_t
+ask_control (int sock, const char *query, char *reply, size_t len)
+{
+    static unsigned int count;
+    ssize_t n;
+    int tag;
+    char buf[FENCE_KDUMP_QUERY_LEN];
+
+    /* whatever is queued now answers an earlier query */
+    while (recv (sock, buf, sizeof (buf), MSG_DONTWAIT) >= 0) {
+        log_debug (1, "dropped a late reply from the daemon\n");
+    }
+
+    tag = snprintf (buf, sizeof (buf), "@%u ", ++count);
+    if (tag + strlen (query) >= sizeof (buf)) {
+        errno = EMSGSIZE;
+        log_error (2, "send (%s)\n", strerror (errno));
+        return (-1);
+    }
+    strcpy (buf + tag, query);
+
+    if (send (sock, buf, strlen (buf), 0) < 0) {
+        log_error (2, "send (%s)\n", strerror (errno));
+        return (-1);
+    }
+
+    for (;;) {
+        n = recv (sock, reply, len - 1, 0);
+        if (n < 0) {
+            log_error (2, "recv (%s)\n", strerror (errno));
+            return (-1);
+        }
+        reply[n] = 0;
+
+        if ((n >= tag) && (strncmp (reply, buf, tag) == 0)) {
+            memmove (reply, reply + tag, n - tag + 1);
+            return (n - tag);
+        }
+
+        log_debug (1, "dropped a late reply from the daemon\n");
+    }
+}
+
+static int
+query_node (const fence_kdump_opts_t *opts, fence_kdump_node_t *node, time_t since)
+{
+    int i;
+    int len;
+    int stage;
+    long long sec;
+    long nsec;
+    char name[16];
+    unsigned long long written;
+    unsigned long long total;
+    char buf[FENCE_KDUMP_QUERY_LEN];
+    char addr[INET6_ADDRSTRLEN];
+    char policy[FENCE_KDUMP_POLICY_LEN];
+
+    print_policy (opts, policy, sizeof (policy));
+
+    len = snprintf (buf, sizeof (buf), "SEEN %lld %s %s",
+                    (long long) since, node->info->name, policy);
+
+    for (i = 0; i < node->info->nkeys; i++) {
+        print_addr (&node->info->keys[i], addr, sizeof (addr));
+        if (len + 1 + strlen (addr) >= sizeof (buf)) {
+            break;
+        }
+        len += snprintf (buf + len, sizeof (buf) - len, " %s", addr);
+    }
+
+    if (ask_control (opts->control, buf, buf, sizeof (buf)) < 0) {
+        return (-1);
+    }
+
+    if (strncmp (buf, "YES", 3) == 0) {
+        if (sscanf (buf, "YES %lld.%ld %15s %llu %llu",
+                    &sec, &nsec, name, &written, &total) == 5) {
+            node->last.tv_sec = sec;
+            node->last.tv_nsec = nsec;
+            stage = parse_stage (name);
+            node->progress.stage = (stage < 0) ? FENCE_KDUMP_STAGE_NONE : stage;
+            node->progress.written = written;
+            node->progress.total = total;
+        }
+        return (0);
+    }
+    if (strncmp (buf, "ERR", 3) == 0) {
+        log_error (0, "daemon query for '%s' failed (%s)\n", node->info->name, buf);
+        return (-1);
+    }
+
+    return (1);
+}
+
+/*
+ * Waits for the nodes by asking a running daemon. A message is
+ * accepted if the daemon received it up to TIMEOUT seconds before the
+ * agent was started, so a packet sent before fencing began is not lost.
+ * Once the daemon stops answering or refuses a query, the nodes not
+ * heard from yet fail at once.
+ */
+static int
+do_action_off_query (fence_kdump_opts_t *opts)
+{
+    int error;
+    time_t since;
+    fence_kdump_node_t *node;
+    struct timespec now;
+    struct timespec deadline;
+    struct timespec interval;
+
+    clock_gettime (CLOCK_MONOTONIC, &opts->started);
+
+    deadline = opts->started;
+    deadline.tv_sec += opts->timeout;
+
+    since = time (NULL) - opts->timeout;
+
+    interval.tv_sec = 0;
+    interval.tv_nsec = FENCE_KDUMP_QUERY_INTERVAL * 1000000L;
+
+    opts->pending = 0;
+    for_each_node (node, &opts->nodes) {
+        log_debug (0, "waiting for message from '%s' via '%s'\n",
+                   node->info->addr, opts->sockpath);
+        opts->pending++;
+    }
+
+    for (;;) {
+        for_each_node (node, &opts->nodes) {
+            if (node->fenced != 0) {
+                continue;
+            }
+            /* waiting on would only end in a timeout that proves nothing */
+            error = query_node (opts, node, since);
+            if (error < 0) {
+                log_error (0, "cannot wait for nodes via '%s'\n", opts->sockpath);
+                return (finish_off (opts, "error"));
+            }
+            if (error == 0) {
+                mark_node (opts, node);
+            }
+        }
+
+        if (opts->pending == 0) {
+            break;
+        }
+
+        clock_gettime (CLOCK_MONOTONIC, &now);
+        if ((now.tv_sec > deadline.tv_sec) ||
+            ((now.tv_sec == deadline.tv_sec) && (now.tv_nsec >= deadline.tv_nsec))) {
+            log_debug (0, "timeout after %d seconds\n", opts->timeout);
+            break;
+        }
+
+        nanosleep (&interval, NULL);
+    }
+
+    return (finish_off (opts, "timeout"));
+}
+
+/*
+ * Adds the nodes this agent saw itself to the last-seen table, so that
+ * a later "status" knows about them without a daemon.
+ */
+static void
+save_seen_nodes (const fence_kdump_opts_t *opts)
+{
+    int n;
+    int added = 0;
+    fence_kdump_seen_t add;
+    fence_kdump_seen_t *seen;
+    fence_kdump_node_t *node;
+
+    seen = calloc (FENCE_KDUMP_MAX_RECORDS, sizeof (fence_kdump_seen_t));
+    if (!seen) {
+        log_error (2, "calloc (%s)\n", strerror (errno));
+        return;
+    }
+
+    n = read_seen_file (opts->seenpath, seen, FENCE_KDUMP_MAX_RECORDS);
+    if (n < 0) {
+        n = 0;
+    }
+
+    for_each_node (node, &opts->nodes) {
+        if (node->fenced == 0) {
+            continue;
+        }
+        /* recorded as the daemon would have recorded the message */
+        memset (&add, 0, sizeof (add));
+        add.addr = node->info->from;
+        snprintf (add.node, sizeof (add.node), "%s", node->info->id);
+        add.last = node->last;
+        add.progress = node->progress;
+        memcpy (add.boot_id, node->boot_id, sizeof (add.boot_id));
+        add.seq = node->seq;
+        n = merge_seen (seen, n, FENCE_KDUMP_MAX_RECORDS, &add);
+        added++;
+    }
+
+    if ((added > 0) && (write_seen_file (opts->seenpath, seen, n) != 0)) {
+        log_error (1, "failed to write last-seen table '%s' (%s)\n",
+                   opts->seenpath, strerror (errno));
+    }
+
+    free (seen);
+}
+
+/*
+ * Looks the nodes up in the last-seen table. A node is seen if any of
+ * its addresses has a record at or after since.
+ */
+static int
+read_seen_nodes (fence_kdump_opts_t *opts, time_t since)
+{
+    int i;
+    int k;
+    int n;
+    fence_kdump_seen_t *seen;
+    const fence_kdump_seen_t *best;
+    fence_kdump_node_t *node;
+
+    seen = calloc (FENCE_KDUMP_MAX_RECORDS, sizeof (fence_kdump_seen_t));
+    if (!seen) {
+        log_error (2, "calloc (%s)\n", strerror (errno));
+        return (-1);
+    }
+
+    n = read_seen_file (opts->seenpath, seen, FENCE_KDUMP_MAX_RECORDS);
+    if (n < 0) {
+        log_debug (1, "no last-seen table '%s' (%s)\n", opts->seenpath, strerror (errno));
+        n = 0;
+    }
+
+    opts->pending = 0;
+    for_each_node (node, &opts->nodes) {
+        best = NULL;
+        for (i = 0; i < n; i++) {
+            if ((seen[i].last.tv_sec < since) ||
+                ((seen[i].node[0] != 0) && !match_identity (node->info->name, seen[i].node))) {
+                continue;
+            }
+            for (k = 0; k < node->info->nkeys; k++) {
+                if ((memcmp (&node->info->keys[k], &seen[i].addr, sizeof (seen[i].addr)) == 0) &&
+                    ((best == NULL) || (seen[i].last.tv_sec > best->last.tv_sec))) {
+                    best = &seen[i];
+                }
+            }
+        }
+        if (best != NULL) {
+            node->fenced = 1;
+            node->last = best->last;
+            node->progress = best->progress;
+        } else {
+            opts->pending++;
+        }
+    }
+
+    free (seen);
+
+    return (0);
+}
+
+/*
+ * Starts each node from the boot id and sequence number last accepted
+ * from it, so that a message accepted by an earlier run is not
+ * accepted again. Only version 2 records carry them.
+ */
+static void
+read_replay_nodes (fence_kdump_opts_t *opts)
+{
+    int i;
+    int k;
+    int n;
+    fence_kdump_seen_t *seen;
+    const fence_kdump_seen_t *best;
+    fence_kdump_node_t *node;
+
+    seen = calloc (FENCE_KDUMP_MAX_RECORDS, sizeof (fence_kdump_seen_t));
+    if (!seen) {
+        log_error (2, "calloc (%s)\n", strerror (errno));
+        return;
+    }
+
+    n = read_seen_file (opts->seenpath, seen, FENCE_KDUMP_MAX_RECORDS);
+    if (n < 0) {
+        log_debug (1, "no last-seen table '%s' (%s)\n", opts->seenpath, strerror (errno));
+        n = 0;
+    }
+
+    for_each_node (node, &opts->nodes) {
+        best = NULL;
+        for (i = 0; i < n; i++) {
+            if ((seen[i].node[0] == 0) || !match_identity (node->info->name, seen[i].node)) {
+                continue;
+            }
+            for (k = 0; k < node->info->nkeys; k++) {
+                if ((memcmp (&node->info->keys[k], &seen[i].addr, sizeof (seen[i].addr)) == 0) &&
+                    ((best == NULL) || (seen[i].last.tv_sec > best->last.tv_sec))) {
+                    best = &seen[i];
+                }
+            }
+        }
+        if (best != NULL) {
+            memcpy (node->boot_id, best->boot_id, sizeof (node->boot_id));
+            node->seq = best->seq;
+            log_debug (1, "node '%s' last sequence number %llu\n",
+                       node->info->name, (unsigned long long) node->seq);
+        }
+    }
+
+    free (seen);
+}
+
+static void
+print_status (const fence_kdump_opts_t *opts, const fence_kdump_node_t *node)
+{
+    fence_kdump_output_t out;
+
+    begin_output (&out, stdout, (opts->output != FENCE_KDUMP_OUTPUT_NONE) ?
+                  opts->output : FENCE_KDUMP_OUTPUT_KV);
+    add_output_str (&out, "node", node->info->name);
+    add_output_str (&out, "status", (node->fenced != 0) ? "dumping" : "unknown");
+    if (node->fenced != 0) {
+        add_node_output (&out, node);
+    }
+    end_output (&out);
+}
+
+/*
+ * Reports whether each node was seen dumping within the last TIMEOUT
+ * seconds, with the progress it last reported. A running daemon is
+ * asked once; without one the last-seen table is read if there is one,
+ * and otherwise no node is known to be dumping. Nothing waits on the
+ * network, so "status" returns at once. Like other agents, 2
+ * means every node is off (dumping) and 0 that at least one is not
+ * known to be.
+ */
+static int
+do_action_status (fence_kdump_opts_t *opts)
+{
+    fence_kdump_node_t *node;
+
+    if (opts->control >= 0) {
+        opts->pending = 0;
+        for_each_node (node, &opts->nodes) {
+            if (query_node (opts, node, time (NULL) - opts->timeout) == 0) {
+                node->fenced = 1;
+            } else {
+                opts->pending++;
+            }
+        }
+    } else if (opts->seenpath != NULL) {
+        read_seen_nodes (opts, time (NULL) - opts->timeout);
+    } else {
+        log_debug (1, "no daemon on '%s' and no last-seen table, no node is known\n",
+                   opts->sockpath);
+        opts->pending = opts->nodes.count;
+    }
+
+    log_flush ();
+
+    for_each_node (node, &opts->nodes) {
+        print_status (opts, node);
+    }
+
+    return ((opts->pending == 0) ? 2 : 0);
+}
+
+static const fence_opt_t options[] = {
+    { 'n', "nodename", required_argument, "nodename", NULL, "NODE[,NODE]",
+      "string", NULL, NULL,
+      "Name or IP address of node(s) to be fenced",
+      "Name or IP address of node(s) to be fenced", 0 },
+    { 'p', "ipport", required_argument, "ipport", NULL, "PORT",
+      "string", FENCE_OPTS_STR (FENCE_KDUMP_DEFAULT_IPPORT), NULL,
+      "Port number",
+      "IP port number (default: " FENCE_OPTS_STR (FENCE_KDUMP_DEFAULT_IPPORT) ")", 0 },
+    { 'f', "family", required_argument, "family", NULL, "FAMILY",
+      "string", "auto", NULL,
+      "Network family",
+      "Network family: ([auto], ipv4, ipv6)", 0 },
+    { 'o', "action", required_argument, "action", NULL, "ACTION",
+      "string", "off", NULL,
+      "Fencing action",
+      "Fencing action: ([off], status, monitor, metadata)", 0 },
+    { 't', "timeout", required_argument, "timeout", NULL, "TIMEOUT",
+      "string", FENCE_OPTS_STR (FENCE_KDUMP_DEFAULT_TIMEOUT), NULL,
+      "Timeout in seconds",
+      "Timeout in seconds (default: " FENCE_OPTS_STR (FENCE_KDUMP_DEFAULT_TIMEOUT) ")", 0 },
+    { 'k', "key-file", required_argument, "key_file", NULL, "FILE",
+      "string", NULL, NULL,
+      "File containing the shared message key",
+      "File containing the shared message key", 0 },
+    { 'a', "allow-v1", optional_argument, "allow_v1", NULL, NULL,
+      "boolean", NULL, NULL,
+      "Accept unauthenticated version 1 messages",
+      "Accept unauthenticated messages with a key", 0 },
+    { 'D', "daemon", optional_argument, "daemon", NULL, NULL,
+      "boolean", NULL, NULL,
+      "Run as a daemon",
+      "Keep listening and answer queries on SOCKET",
+      FENCE_OPT_NO_STDIN | FENCE_OPT_NO_METADATA },
+    { 'R', "reuseport", optional_argument, "reuseport", NULL, NULL,
+      "boolean", NULL, NULL,
+      "Share the listening port with other instances",
+      "Share the port with other listeners", 0 },
+    { 'S', "socket", required_argument, "socket", NULL, "SOCKET",
+      "string", FENCE_KDUMP_DEFAULT_SOCKET, NULL,
+      "Query socket of a running fence_kdump daemon",
+      "Daemon query socket (default: " FENCE_KDUMP_DEFAULT_SOCKET ")", 0 },
+    { 'j', "journal", required_argument, "journal", NULL, "FILE",
+      "string", NULL, NULL,
+      "Journal file recording every received packet",
+      "Record every received packet in FILE", 0 },
+    { 'r', "resolve-timeout", required_argument, "resolve_timeout", NULL, "MSEC",
+      "string", FENCE_OPTS_STR (FENCE_KDUMP_DEFAULT_RESOLVE_TIMEOUT), NULL,
+      "Milliseconds allowed for name resolution",
+      "Time allowed for name resolution (default: "
+      FENCE_OPTS_STR (FENCE_KDUMP_DEFAULT_RESOLVE_TIMEOUT) ")", 0 },
+    { 'C', "dns-cache", required_argument, "dns_cache", NULL, "FILE",
+      "string", NULL, NULL,
+      "Cache of node addresses used when name resolution is slow",
+      "Cache of node addresses used when DNS is slow", 0 },
+    { 'l', "seen-file", required_argument, "seen_file", NULL, "FILE",
+      "string", NULL, NULL,
+      "Table of the nodes last seen dumping, used by status",
+      "Last-seen table read by status", 0 },
+    { 'm', "multicast", required_argument, "multicast", NULL, "GROUP",
+      "string", NULL, NULL,
+      "Multicast group to join",
+      "Multicast group to join", 0 },
+    { 'e', "interface", required_argument, "interface", NULL, "IFACE",
+      "string", NULL, NULL,
+      "Interface on which to join the multicast group",
+      "Interface on which to join the group", 0 },
+    { 'O', "output", required_argument, "output", NULL, "FORMAT",
+      "string", NULL, NULL,
+      "Per-node verdicts printed on stdout",
+      "Print per-node verdicts: (kv, json)", 0 },
+    { 'P', "packet", required_argument, "packet", NULL, "MODE",
+      "string", "none", NULL,
+      "Capture the port with a packet socket",
+      "Packet capture: ([none], fallback, always)", 0 },
+    { 'v', "verbose", optional_argument, "verbose", NULL, NULL,
+      "boolean", NULL, NULL,
+      "Print verbose output",
+      "Print verbose output", 0 },
+    { 'V', "version", no_argument, "version", NULL, NULL,
+      "boolean", NULL, NULL,
+      "Print version",
+      "Print version", FENCE_OPT_NO_STDIN },
+    { 'h', "help", no_argument, "usage", NULL, NULL,
+      "boolean", NULL, NULL,
+      "Print usage",
+      "Print usage", FENCE_OPT_NO_STDIN },
+    { 0 }
+};
+
+static const char *const actions[] = { "off", "status", "monitor", "metadata", NULL };
+
+static int set_option (void *ctx, int id, const char *arg);
+
+static fence_opts_t options_table = {
+    .name       = NULL,
+    .shortdesc  = "Fence agent for use with kdump",
+    .longdesc   = "The fence_kdump agent is intended to be used with with kdump service.",
+    .vendor_url = "http://www.kernel.org/pub/linux/utils/kernel/kexec/",
+    .actions    = actions,
+    .opt        = options,
+    .set        = set_option,
+};
+
+
+static int
+get_options_node (fence_kdump_opts_t *opts, const fence_kdump_resolve_t *res)
+{
+    int i;
+    int error;
+    int added = 0;
+    fence_kdump_node_t *node;
+    fence_kdump_node_info_t *info;
+
+    node = add_node (&opts->nodes);
+    if (node == NULL) {
+        log_error (2, "too many nodes\n");
+        return (1);
+    }
+
+    info = node->info;
+
+    strncpy (info->name, res->name, sizeof (info->name) - 1);
+    snprintf (info->port, sizeof (info->port), "%d", opts->ipport);
+
+    for (i = 0; i < res->count; i++) {
+        if (set_addr (&info->keys[info->nkeys], (const struct sockaddr *) &res->addr[i]) != 0) {
+            continue;
+        }
+        error = add_addrset (&opts->addrs, &info->keys[info->nkeys], node);
+        if (error < 0) {
+            log_error (2, "calloc (%s)\n", strerror (errno));
+            return (1);
+        }
+        added += error;
+        info->nkeys++;
+    }
+
+    /* every address already belongs to an earlier node */
+    if (added == 0) {
+        log_debug (1, "ignore duplicate node '%s'\n", info->name);
+        drop_node (&opts->nodes);
+        return (0);
+    }
+
+    print_addr (&info->keys[0], info->addr, sizeof (info->addr));
+
+    return (0);
+}
 
+/*
+ * Resolve all nodes at once, bounded by the resolve timeout, so that a
+ * slow DNS server does not eat into the fence timeout. Addresses are
+ * used as they are, and names the resolver did not answer for in time
+ * are taken from the address cache.
+ */
 static int
-trim (char *str)
+get_options_nodes (fence_kdump_opts_t *opts)
 {
-    char *p;
-    int len;
+    int i;
+    int n = 0;
+    int busy;
+    int error = 0;
+    char *list;
+    char *name;
+    char *save;
+    char **names;
+    fence_kdump_resolve_t *res;
+
+    list = strdup (opts->nodename);
+    names = calloc (strlen (opts->nodename) / 2 + 1, sizeof (char *));
+    if (!list || !names) {
+        log_error (2, "malloc (%s)\n", strerror (errno));
+        free (list);
+        free (names);
+        return (1);
+    }
 
-    if (!str) return (0);
+    for (name = strtok_r (list, FENCE_KDUMP_NODE_SEP, &save); name != NULL;
+         name = strtok_r (NULL, FENCE_KDUMP_NODE_SEP, &save)) {
+        names[n++] = name;
+    }
 
-    len = strlen (str);
+    if (n == 0) {
+        log_error (0, "no nodes in '%s'\n", opts->nodename);
+        free (list);
+        free (names);
+        return (1);
+    }
 
-    while (len--) {
-        if (isspace (str[len])) {
-            str[len] = 0;
-        } else {
+    res = calloc (n, sizeof (fence_kdump_resolve_t));
+    if (!res || (alloc_nodes (&opts->nodes, n) != 0)) {
+        log_error (2, "calloc (%s)\n", strerror (errno));
+        free (res);
+        free (list);
+        free (names);
+        return (1);
+    }
+
+    for (i = 0; i < n; i++) {
+        init_resolve (&res[i], names[i], opts->family, opts->ipport);
+    }
+
+    busy = resolve_names (res, n, opts->resolve_timeout);
+
+    read_resolve_cache (res, n, opts->cachepath);
+
+    if (write_resolve_cache (res, n, opts->cachepath) != 0) {
+        log_debug (1, "failed to update cache '%s' (%s)\n",
+                   opts->cachepath, strerror (errno));
+    }
+
+    for (i = 0; (i < n) && (error == 0); i++) {
+        if (res[i].source == FENCE_KDUMP_RESOLVE_NONE) {
+            log_error (0, "failed to resolve node '%s'\n", names[i]);
+            error = 1;
             break;
         }
+        if (res[i].source == FENCE_KDUMP_RESOLVE_CACHE) {
+            log_debug (0, "using cached addresses of node '%s'\n", names[i]);
+        }
+        if (get_options_node (opts, &res[i]) != 0) {
+            log_error (0, "failed to get node '%s'\n", names[i]);
+            error = 1;
+        }
     }
 
-    for (p = str; *p && isspace (*p); p++);
+    /* a lookup that could not be cancelled may still write to these */
+    if (busy == 0) {
+        free (res);
+        free (list);
+    }
 
-    memmove (str, p, strlen (p) + 1);
+    free (names);
 
-    return (strlen (str));
+    return (error);
 }
 
 static int
-read_message (const fence_kdump_node_t *node, void *msg, int len)
+add_socket (fence_kdump_opts_t *opts, const struct addrinfo *info)
 {
-    int error;
-    char addr[NI_MAXHOST];
-    char port[NI_MAXSERV];
-    struct sockaddr_storage ss;
-    socklen_t size = sizeof (ss);
+    int sock;
+    int on = 1;
 
-    error = recvfrom (node->socket, msg, len, 0, (struct sockaddr *) &ss, &size);
-    if (error < 0) {
-        log_error (2, "recvfrom (%s)\n", strerror (errno));
-        goto out;
+    if (opts->nsockets >= FENCE_KDUMP_MAX_SOCKETS) {
+        log_error (2, "too many sockets\n");
+        return (1);
     }
 
-    error = getnameinfo ((struct sockaddr *) &ss, size,
-                         addr, sizeof (addr),
-                         port, sizeof (port),
-                         NI_NUMERICHOST | NI_NUMERICSERV);
-    if (error != 0) {
-        log_error (2, "getnameinfo (%s)\n", gai_strerror (error));
-        goto out;
+    sock = socket (info->ai_family,
+                   info->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                   info->ai_protocol);
+    if (sock < 0) {
+        log_error (2, "socket (%s)\n", strerror (errno));
+        return (1);
+    }
+
+    /* IPv4 senders are heard on a socket of their own */
+    if (info->ai_family == AF_INET6) {
+        setsockopt (sock, IPPROTO_IPV6, IPV6_V6ONLY, &on, sizeof (on));
+    }
+
+    /* receive timestamps, to measure how long a message waited */
+    setsockopt (sock, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof (on));
+
+    if ((opts->reuseport != 0) &&
+        (setsockopt (sock, SOL_SOCKET, SO_REUSEPORT, &on, sizeof (on)) != 0)) {
+        log_error (2, "setsockopt (%s)\n", strerror (errno));
+        close (sock);
+        return (1);
+    }
+
+    if (bind (sock, info->ai_addr, info->ai_addrlen) != 0) {
+        log_error (2, "bind (%s)\n", strerror (errno));
+        close (sock);
+        return (1);
+    }
+
+    opts->sockets[opts->nsockets++] = sock;
+
+    return (0);
+}
+
+/*
+ * Senders may publish to a multicast group instead of to each peer,
+ * so the listening socket joins it. Only membership changes, senders
+ * are still matched against the node list by their source address.
+ */
+static int
+get_options_group (fence_kdump_opts_t *opts, int sock, int family)
+{
+    unsigned int ifindex;
+    fence_kdump_addr_t group;
+
+    if (parse_addr (&group, opts->group) != 0) {
+        log_error (2, "invalid multicast group '%s'\n", opts->group);
+        return (1);
+    }
+
+    if (!is_addr_multicast (&group)) {
+        return (0);
+    }
+
+    /* in auto mode the group is joined on the socket of its family */
+    if ((family == AF_INET) != is_addr_v4mapped (&group)) {
+        return (0);
+    }
+
+    if (get_ifindex (opts->interface, &ifindex) != 0) {
+        log_error (0, "unknown interface '%s'\n", opts->interface);
+        return (1);
+    }
+
+    if (join_group (sock, &group, ifindex) != 0) {
+        log_error (0, "failed to join '%s' (%s)\n", opts->group, strerror (errno));
+        return (1);
     }
 
-    error = strcasecmp (node->addr, addr);
+    log_debug (1, "joined multicast group '%s'\n", opts->group);
+
+    return (0);
+}
+
+static int
+get_options_listen (fence_kdump_opts_t *opts, int family)
+{
+    int error;
+    char port[FENCE_KDUMP_PORT_LEN];
+    struct addrinfo hints;
+    struct addrinfo *info = NULL;
+
+    memset (&hints, 0, sizeof (hints));
+
+    hints.ai_family = family;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_protocol = IPPROTO_UDP;
+    hints.ai_flags = AI_NUMERICSERV | AI_PASSIVE;
+
+    snprintf (port, sizeof (port), "%d", opts->ipport);
+
+    error = getaddrinfo (NULL, port, &hints, &info);
     if (error != 0) {
-        log_debug (1, "discard message from '%s'\n", addr);
+        log_error (2, "getaddrinfo (%s)\n", gai_strerror (error));
+        return (1);
+    }
+
+    error = add_socket (opts, info);
+
+    freeaddrinfo (info);
+
+    if ((error == 0) && (opts->group != NULL) &&
+        (get_options_group (opts, opts->sockets[opts->nsockets - 1], family) != 0)) {
+        close (opts->sockets[--opts->nsockets]);
+        error = 1;
     }
 
-out:
     return (error);
 }
 
+/*
+ * Listen on the configured family, or in auto mode on an IPv6 and an
+ * IPv4 socket at once, so that a node is heard whichever family its
+ * kdump kernel comes up with. A host that lacks one of the families
+ * gets by with the other.
+ */
 static int
-do_action_off (const fence_kdump_opts_t *opts)
+get_options_sockets (fence_kdump_opts_t *opts)
 {
-    int error;
-    fd_set rfds;
-    fence_kdump_msg_t msg;
-    fence_kdump_node_t *node;
-    struct timeval timeout;
+    int error4;
+    int error6;
+
+    if (opts->family != FENCE_KDUMP_FAMILY_AUTO) {
+        return (get_options_listen (opts, opts->family));
+    }
+
+    error6 = get_options_listen (opts, FENCE_KDUMP_FAMILY_IPV6);
+    error4 = get_options_listen (opts, FENCE_KDUMP_FAMILY_IPV4);
+
+    return ((error6 != 0) && (error4 != 0));
+}
 
-    if (list_empty (&opts->nodes)) {
+/*
+ * Captures the port on the interface given for the multicast group, or
+ * on all of them. A group is not joined by the capture: the packets of
+ * a group only arrive if something else on the host joined it.
+ */
+static int
+get_options_packet (fence_kdump_opts_t *opts)
+{
+    unsigned int ifindex;
+
+    if (get_ifindex (opts->interface, &ifindex) != 0) {
+        log_error (0, "unknown interface '%s'\n", opts->interface);
         return (1);
-    } else {
-        node = list_first_entry (&opts->nodes, fence_kdump_node_t, list);
     }
 
-    timeout.tv_sec = opts->timeout;
-    timeout.tv_usec = 0;
+    if (open_ring (&opts->ring, ifindex, opts->ipport) != 0) {
+        log_error (0, "failed to capture port '%d' (%s)\n", opts->ipport, strerror (errno));
+        return (1);
+    }
 
-    FD_ZERO (&rfds);
-    FD_SET (node->socket, &rfds);
+    log_debug (1, "capturing port '%d' on %s\n", opts->ipport,
+               (opts->interface != NULL) ? opts->interface : "all interfaces");
 
-    log_debug (0, "waiting for message from '%s'\n", node->addr);
+    return (0);
+}
 
-    for (;;) {
-        error = select (node->socket + 1, &rfds, NULL, NULL, &timeout);
-        if (error < 0) {
-            log_error (2, "select (%s)\n", strerror (errno));
-            break;
-        }
-        if (error == 0) {
-            log_debug (0, "timeout after %d seconds\n", opts->timeout);
-            break;
-        }
+/*
+ * Listens on the port, or captures it instead when that is asked for or
+ * the port cannot be bound, say because another program holds it.
+ */
+static int
+get_options_receive (fence_kdump_opts_t *opts)
+{
+    if ((opts->packet != FENCE_KDUMP_PACKET_ALWAYS) && (get_options_sockets (opts) == 0)) {
+        return (0);
+    }
+
+    if (opts->packet == FENCE_KDUMP_PACKET_NONE) {
+        return (1);
+    }
+
+    if (opts->packet == FENCE_KDUMP_PACKET_FALLBACK) {
+        log_debug (0, "failed to listen on port '%d', capturing it instead\n", opts->ipport);
+    }
+
+    return (get_options_packet (opts));
+}
+
+/*
+ * Takes over the sockets passed by systemd socket activation, so the
+ * port is held open before the agent even starts. UDP sockets are
+ * listened on as they are, a unix datagram socket becomes the query
+ * socket of the daemon. Returns the number of sockets taken.
+ */
+static int
+get_options_activation (fence_kdump_opts_t *opts)
+{
+    int fd;
+    int n;
+    int type;
+    int on = 1;
+    int taken = 0;
+    const char *env;
+    socklen_t len;
+    struct sockaddr_storage ss;
 
-        if (read_message (node, &msg, sizeof (msg)) != 0) {
+    env = getenv ("LISTEN_PID");
+    if ((env == NULL) || (atol (env) != (long) getpid ())) {
+        return (0);
+    }
+
+    env = getenv ("LISTEN_FDS");
+    n = (env != NULL) ? atoi (env) : 0;
+
+    for (fd = FENCE_KDUMP_LISTEN_FDS_START; fd < FENCE_KDUMP_LISTEN_FDS_START + n; fd++) {
+        len = sizeof (type);
+        if ((getsockopt (fd, SOL_SOCKET, SO_TYPE, &type, &len) != 0) ||
+            (type != SOCK_DGRAM)) {
             continue;
         }
 
-        if (msg.magic != FENCE_KDUMP_MAGIC) {
-            log_debug (1, "invalid magic number '0x%X'\n", msg.magic);
+        len = sizeof (ss);
+        if (getsockname (fd, (struct sockaddr *) &ss, &len) != 0) {
             continue;
         }
 
-        switch (msg.version) {
-        case FENCE_KDUMP_MSGV1:
-            log_debug (0, "received valid message from '%s'\n", node->addr);
-            return (0);
-        default:
-            log_debug (1, "invalid message version '0x%X'\n", msg.version);
+        if ((ss.ss_family == AF_UNIX) && (opts->daemon != 0) && (opts->control < 0)) {
+            opts->control = fd;
+        } else if (((ss.ss_family == AF_INET) || (ss.ss_family == AF_INET6)) &&
+                   (opts->nsockets < FENCE_KDUMP_MAX_SOCKETS)) {
+            if ((opts->group != NULL) && (get_options_group (opts, fd, ss.ss_family) != 0)) {
+                continue;
+            }
+            opts->sockets[opts->nsockets++] = fd;
+            /* the port systemd bound is the one queries must name */
+            opts->ipport = get_port ((struct sockaddr *) &ss);
+        } else {
             continue;
         }
+
+        fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) | O_NONBLOCK);
+        fcntl (fd, F_SETFD, FD_CLOEXEC);
+        if (ss.ss_family != AF_UNIX) {
+            setsockopt (fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof (on));
+        }
+        taken++;
     }
 
-    return (1);
-}
+    unsetenv ("LISTEN_PID");
+    unsetenv ("LISTEN_FDS");
+    unsetenv ("LISTEN_FDNAMES");
 
-static int
-do_action_metadata (const char *self)
-{
-    fprintf (stdout, "<?xml version=\"1.0\" ?>\n");
-    fprintf (stdout, "<resource-agent name=\"%s\"", basename (self));
-    fprintf (stdout, " shortdesc=\"Fence agent for use with kdump\">\n");
-    fprintf (stdout, "<longdesc>");
-    fprintf (stdout, "The fence_kdump agent is intended to be used with with kdump service.");
-    fprintf (stdout, "</longdesc>\n");
-    fprintf (stdout, "<vendor-url>http://www.kernel.org/pub/linux/utils/kernel/kexec/</vendor-url>\n");
-
-    fprintf (stdout, "<parameters>\n");
-
-    fprintf (stdout, "\t<parameter name=\"nodename\" unique=\"0\" required=\"0\">\n");
-    fprintf (stdout, "\t\t<getopt mixed=\"-n, --nodename\" />\n");
-    fprintf (stdout, "\t\t<content type=\"string\" />\n");
-    fprintf (stdout, "\t\t<shortdesc lang=\"en\">%s</shortdesc>\n",
-             "Name or IP address of node to be fenced");
-    fprintf (stdout, "\t</parameter>\n");
-
-    fprintf (stdout, "\t<parameter name=\"ipport\" unique=\"0\" required=\"0\">\n");
-    fprintf (stdout, "\t\t<getopt mixed=\"-p, --ipport\" />\n");
-    fprintf (stdout, "\t\t<content type=\"string\" default=\"7410\" />\n");
-    fprintf (stdout, "\t\t<shortdesc lang=\"en\">%s</shortdesc>\n",
-             "Port number");
-    fprintf (stdout, "\t</parameter>\n");
-
-    fprintf (stdout, "\t<parameter name=\"family\" unique=\"0\" required=\"0\">\n");
-    fprintf (stdout, "\t\t<getopt mixed=\"-f, --family\" />\n");
-    fprintf (stdout, "\t\t<content type=\"string\" default=\"auto\" />\n");
-    fprintf (stdout, "\t\t<shortdesc lang=\"en\">%s</shortdesc>\n",
-             "Network family");
-    fprintf (stdout, "\t</parameter>\n");
-
-    fprintf (stdout, "\t<parameter name=\"action\" unique=\"0\" required=\"0\">\n");
-    fprintf (stdout, "\t\t<getopt mixed=\"-o, --action\" />\n");
-    fprintf (stdout, "\t\t<content type=\"string\" default=\"off\" />\n");
-    fprintf (stdout, "\t\t<shortdesc lang=\"en\">%s</shortdesc>\n",
-             "Fencing action");
-    fprintf (stdout, "\t</parameter>\n");
-
-    fprintf (stdout, "\t<parameter name=\"timeout\" unique=\"0\" required=\"0\">\n");
-    fprintf (stdout, "\t\t<getopt mixed=\"-t, --timeout\" />\n");
-    fprintf (stdout, "\t\t<content type=\"string\" default=\"60\" />\n");
-    fprintf (stdout, "\t\t<shortdesc lang=\"en\">%s</shortdesc>\n",
-             "Timeout in seconds");
-    fprintf (stdout, "\t</parameter>\n");
-
-    fprintf (stdout, "\t<parameter name=\"verbose\" unique=\"0\" required=\"0\">\n");
-    fprintf (stdout, "\t\t<getopt mixed=\"-v, --verbose\" />\n");
-    fprintf (stdout, "\t\t<content type=\"boolean\" />\n");
-    fprintf (stdout, "\t\t<shortdesc lang=\"en\">%s</shortdesc>\n",
-             "Print verbose output");
-    fprintf (stdout, "\t</parameter>\n");
-
-    fprintf (stdout, "\t<parameter name=\"version\" unique=\"0\" required=\"0\">\n");
-    fprintf (stdout, "\t\t<getopt mixed=\"-V, --version\" />\n");
-    fprintf (stdout, "\t\t<content type=\"boolean\" />\n");
-    fprintf (stdout, "\t\t<shortdesc lang=\"en\">%s</shortdesc>\n",
-             "Print version");
-    fprintf (stdout, "\t</parameter>\n");
-
-    fprintf (stdout, "\t<parameter name=\"usage\" unique=\"0\" required=\"0\">\n");
-    fprintf (stdout, "\t\t<getopt mixed=\"-h, --help\" />\n");
-    fprintf (stdout, "\t\t<content type=\"boolean\" />\n");
-    fprintf (stdout, "\t\t<shortdesc lang=\"en\">%s</shortdesc>\n",
-             "Print usage");
-    fprintf (stdout, "\t</parameter>\n");
-
-    fprintf (stdout, "</parameters>\n");
-
-    fprintf (stdout, "<actions>\n");
-    fprintf (stdout, "\t<action name=\"off\" />\n");
-    fprintf (stdout, "\t<action name=\"metadata\" />\n");
-    fprintf (stdout, "</actions>\n");
-
-    fprintf (stdout, "</resource-agent>\n");
+    if (taken > 0) {
+        log_debug (1, "took over %d activated socket(s)\n", taken);
+        opts->activated = 1;
+    }
 
-    return (0);
+    return (taken);
 }
 
+/*
+ * Has the kernel drop packets that can never be accepted before they
+ * wake the agent. The journal is there to show what was rejected, so
+ * nothing is filtered when it is enabled.
+ */
 static void
-print_usage (const char *self)
-{
-    fprintf (stdout, "Usage: %s [options]\n", basename (self));
-    fprintf (stdout, "\n");
-    fprintf (stdout, "Options:\n");
-    fprintf (stdout, "\n");
-    fprintf (stdout, "%s\n",
-             "  -n, --nodename=NODE          Name or IP address of node to be fenced");
-    fprintf (stdout, "%s\n",
-             "  -p, --ipport=PORT            IP port number (default: 7410)");
-    fprintf (stdout, "%s\n",
-             "  -f, --family=FAMILY          Network family: ([auto], ipv4, ipv6)");
-    fprintf (stdout, "%s\n",
-             "  -o, --action=ACTION          Fencing action: ([off], metadata)");
-    fprintf (stdout, "%s\n",
-             "  -t, --timeout=TIMEOUT        Timeout in seconds (default: 60)");
-    fprintf (stdout, "%s\n",
-             "  -v, --verbose                Print verbose output");
-    fprintf (stdout, "%s\n",
-             "  -V, --version                Print version");
-    fprintf (stdout, "%s\n",
-             "  -h, --help                   Print usage");
-    fprintf (stdout, "\n");
+get_options_filter (fence_kdump_opts_t *opts)
+{
+    int i;
+    int addrs;
+    static fence_kdump_filter_t filter;
 
-    return;
+    if ((opts->journalpath != NULL) || (opts->nsockets == 0)) {
+        return;
+    }
+
+    addrs = build_filter (&filter, (opts->keyed == 0) || (opts->allow_v1 != 0),
+                          (opts->daemon == 0) ? &opts->addrs : NULL);
+
+    for (i = 0; i < opts->nsockets; i++) {
+        if (attach_filter (opts->sockets[i], &filter) != 0) {
+            log_debug (1, "failed to attach socket filter (%s)\n", strerror (errno));
+            return;
+        }
+    }
+
+    log_debug (1, "attached socket filter of %u instructions%s\n",
+               filter.len, (addrs != 0) ? "" : ", sources not checked");
 }
 
+/*
+ * Binds the port for a moment to see whether it could be listened on.
+ * A port that is already held counts as well: while a node is fenced,
+ * the "off" agent doing it holds the port.
+ */
 static int
-get_options_node (fence_kdump_opts_t *opts)
+probe_port (const fence_kdump_opts_t *opts, int family)
 {
+    int sock;
     int error;
+    int on = 1;
+    char port[FENCE_KDUMP_PORT_LEN];
     struct addrinfo hints;
-    fence_kdump_node_t *node;
-
-    node = malloc (sizeof (fence_kdump_node_t));
-    if (!node) {
-        log_error (2, "malloc (%s)\n", strerror (errno));
-        return (1);
-    }
+    struct addrinfo *info = NULL;
 
-    memset (node, 0, sizeof (fence_kdump_node_t));
     memset (&hints, 0, sizeof (hints));
 
-    hints.ai_family = opts->family;
+    hints.ai_family = family;
     hints.ai_socktype = SOCK_DGRAM;
     hints.ai_protocol = IPPROTO_UDP;
-    hints.ai_flags = AI_NUMERICSERV;
+    hints.ai_flags = AI_NUMERICSERV | AI_PASSIVE;
 
-    strncpy (node->name, opts->nodename, sizeof (node->name));
-    snprintf (node->port, sizeof (node->port), "%d", opts->ipport);
+    snprintf (port, sizeof (port), "%d", opts->ipport);
 
-    node->info = NULL;
-    error = getaddrinfo (node->name, node->port, &hints, &node->info);
+    error = getaddrinfo (NULL, port, &hints, &info);
     if (error != 0) {
         log_error (2, "getaddrinfo (%s)\n", gai_strerror (error));
-        free_node (node);
         return (1);
     }
 
-    error = getnameinfo (node->info->ai_addr, node->info->ai_addrlen,
-                         node->addr, sizeof (node->addr),
-                         node->port, sizeof (node->port),
-                         NI_NUMERICHOST | NI_NUMERICSERV);
-    if (error != 0) {
-        log_error (2, "getnameinfo (%s)\n", gai_strerror (error));
-        free_node (node);
+    sock = socket (info->ai_family, info->ai_socktype | SOCK_CLOEXEC, info->ai_protocol);
+    if (sock < 0) {
+        log_error (2, "socket (%s)\n", strerror (errno));
+        freeaddrinfo (info);
         return (1);
     }
 
-    hints.ai_family = node->info->ai_family;
-    hints.ai_flags |= AI_PASSIVE;
-
-    freeaddrinfo (node->info);
+    if (info->ai_family == AF_INET6) {
+        setsockopt (sock, IPPROTO_IPV6, IPV6_V6ONLY, &on, sizeof (on));
+    }
 
-    node->info = NULL;
-    error = getaddrinfo (NULL, node->port, &hints, &node->info);
-    if (error != 0) {
-        log_error (2, "getaddrinfo (%s)\n", gai_strerror (error));
-        free_node (node);
-        return (1);
+    error = bind (sock, info->ai_addr, info->ai_addrlen);
+    if ((error != 0) && (errno == EADDRINUSE)) {
+        log_debug (1, "port '%d' is held by another listener\n", opts->ipport);
+        error = 0;
+    } else if (error != 0) {
+        log_error (2, "bind (%s)\n", strerror (errno));
     }
 
-    node->socket = socket (node->info->ai_family,
-                           node->info->ai_socktype,
-                           node->info->ai_protocol);
-    if (node->socket < 0) {
-        log_error (2, "socket (%s)\n", strerror (errno));
-        free_node (node);
-        return (1);
+    close (sock);
+    freeaddrinfo (info);
+
+    return (error != 0);
+}
+
+/*
+ * Cheap enough to be run every few seconds: a daemon that answers, or
+ * a port the agent could listen on, is all that "off" needs. Nothing
+ * is kept bound and the port is never captured.
+ */
+static int
+do_action_monitor (fence_kdump_opts_t *opts)
+{
+    char buf[FENCE_KDUMP_QUERY_LEN];
+
+    opts->control = connect_control (opts);
+    if (opts->control >= 0) {
+        if (ask_control (opts->control, "PING", buf, sizeof (buf)) < 0) {
+            log_error (0, "daemon on '%s' does not answer\n", opts->sockpath);
+            return (1);
+        }
+        log_debug (1, "daemon on '%s' is running\n", opts->sockpath);
+        return (0);
     }
 
-    error = bind (node->socket, node->info->ai_addr, node->info->ai_addrlen);
-    if (error != 0) {
-        log_error (2, "bind (%s)\n", strerror (errno));
-        free_node (node);
+    if (((opts->family == FENCE_KDUMP_FAMILY_AUTO) &&
+         (probe_port (opts, FENCE_KDUMP_FAMILY_IPV6) != 0) &&
+         (probe_port (opts, FENCE_KDUMP_FAMILY_IPV4) != 0)) ||
+        ((opts->family != FENCE_KDUMP_FAMILY_AUTO) &&
+         (probe_port (opts, opts->family) != 0))) {
+        log_error (0, "failed to listen on port '%d'\n", opts->ipport);
         return (1);
     }
 
-    list_add_tail (&node->list, &opts->nodes);
+    log_debug (1, "port '%d' is available\n", opts->ipport);
+
+    return (0);
+}
+
+static int
+set_option (void *ctx, int id, const char *arg)
+{
+    fence_kdump_opts_t *opts = ctx;
+
+    switch (id) {
+    case 'n':
+        set_option_nodename (opts, arg);
+        break;
+    case 'p':
+        set_option_ipport (opts, arg);
+        break;
+    case 'f':
+        set_option_family (opts, arg);
+        break;
+    case 'o':
+        set_option_action (opts, arg);
+        break;
+    case 't':
+        set_option_timeout (opts, arg);
+        break;
+    case 'k':
+        set_option_keyfile (opts, arg);
+        break;
+    case 'a':
+        set_option_allow_v1 (opts, arg);
+        break;
+    case 'D':
+        set_option_daemon (opts, arg);
+        break;
+    case 'R':
+        set_option_reuseport (opts, arg);
+        break;
+    case 'S':
+        set_option_sockpath (opts, arg);
+        break;
+    case 'j':
+        set_option_journal (opts, arg);
+        break;
+    case 'r':
+        set_option_resolve_timeout (opts, arg);
+        break;
+    case 'C':
+        set_option_cache (opts, arg);
+        break;
+    case 'l':
+        set_option_seen (opts, arg);
+        break;
+    case 'm':
+        set_option_multicast (opts, arg);
+        break;
+    case 'e':
+        set_option_interface (opts, arg);
+        break;
+    case 'O':
+        set_option_output (opts, arg);
+        break;
+    case 'P':
+        set_option_packet (opts, arg);
+        break;
+    case 'v':
+        set_option_verbose (opts, arg);
+        break;
+    default:
+        /* --version and --help stop parsing */
+        return (id);
+    }
 
     return (0);
 }
@@ -357,50 +2367,18 @@ get_options_node (fence_kdump_opts_t *opts)
 static void
 get_options (int argc, char **argv, fence_kdump_opts_t *opts)
 {
-    int opt;
-
-    struct option options[] = {
-        { "nodename", required_argument, NULL, 'n' },
-        { "ipport",   required_argument, NULL, 'p' },
-        { "family",   required_argument, NULL, 'f' },
-        { "action",   required_argument, NULL, 'o' },
-        { "timeout",  required_argument, NULL, 't' },
-        { "verbose",  optional_argument, NULL, 'v' },
-        { "version",  no_argument,       NULL, 'V' },
-        { "help",     no_argument,       NULL, 'h' },
-        { 0, 0, 0, 0 }
-    };
-
-    while ((opt = getopt_long (argc, argv, "n:p:f:o:t:v::Vh", options, NULL)) != EOF) {
-        switch (opt) {
-        case 'n':
-            set_option_nodename (opts, optarg);
-            break;
-        case 'p':
-            set_option_ipport (opts, optarg);
-            break;
-        case 'f':
-            set_option_family (opts, optarg);
-            break;
-        case 'o':
-            set_option_action (opts, optarg);
-            break;
-        case 't':
-            set_option_timeout (opts, optarg);
-            break;
-        case 'v':
-            set_option_verbose (opts, optarg);
-            break;
-        case 'V':
-            print_version (argv[0]);
-            exit (0);
-        case 'h':
-            print_usage (argv[0]);
-            exit (0);
-        default:
-            print_usage (argv[0]);
-            exit (1);
-        }
+    switch (parse_opts_argv (&options_table, argc, argv, opts)) {
+    case 0:
+        break;
+    case 'V':
+        print_version (argv[0]);
+        exit (0);
+    case 'h':
+        print_opts_usage (&options_table, argv[0], STDOUT_FILENO);
+        exit (0);
+    default:
+        print_opts_usage (&options_table, argv[0], STDOUT_FILENO);
+        exit (1);
     }
 
     verbose = opts->verbose;
@@ -411,52 +2389,7 @@ get_options (int argc, char **argv, fence_kdump_opts_t *opts)
 static void
 get_options_stdin (fence_kdump_opts_t *opts)
 {
-    char buf[1024];
-    char *opt;
-    char *arg;
-
-    while (fgets (buf, sizeof (buf), stdin) != 0) {
-        if (trim (buf) == 0) {
-            continue;
-        }
-        if (buf[0] == '#') {
-            continue;
-        }
-
-        opt = buf;
-
-        if ((arg = strchr (opt, '=')) != 0) {
-            *arg = 0;
-            arg += 1;
-        } else {
-            continue;
-        }
-
-        if (!strcasecmp (opt, "nodename")) {
-            set_option_nodename (opts, arg);
-            continue;
-        }
-        if (!strcasecmp (opt, "ipport")) {
-            set_option_ipport (opts, arg);
-            continue;
-        }
-        if (!strcasecmp (opt, "family")) {
-            set_option_family (opts, arg);
-            continue;
-        }
-        if (!strcasecmp (opt, "action")) {
-            set_option_action (opts, arg);
-            continue;
-        }
-        if (!strcasecmp (opt, "timeout")) {
-            set_option_timeout (opts, arg);
-            continue;
-        }
-        if (!strcasecmp (opt, "verbose")) {
-            set_option_verbose (opts, arg);
-            continue;
-        }
-    }
+    parse_opts_stdin (&options_table, stdin, opts);
 
     verbose = opts->verbose;
 
@@ -479,27 +2412,87 @@ main (int argc, char **argv)
 
     openlog ("fence_kdump", LOG_CONS|LOG_PID, LOG_DAEMON);
 
-    if (opts.action == FENCE_KDUMP_ACTION_OFF) {
-        if (opts.nodename == NULL) {
-            log_error (0, "action 'off' requires nodename\n");
+    if (opts.output != FENCE_KDUMP_OUTPUT_NONE) {
+        log_to_stderr ();
+    }
+
+    log_init ();
+
+    if ((opts.action == FENCE_KDUMP_ACTION_OFF) ||
+        (opts.action == FENCE_KDUMP_ACTION_STATUS) || (opts.daemon != 0)) {
+        if ((opts.daemon == 0) && (opts.nodename == NULL)) {
+            log_error (0, "action requires nodename\n");
+            exit (1);
+        }
+
+        /*
+         * Arm before the key and the node names are looked at: a node
+         * that panicked a moment ago may already be sending, and once
+         * the port is bound the kernel queues its packets for us.
+         */
+        if ((get_options_activation (&opts) == 0) && (opts.daemon == 0)) {
+            opts.control = connect_control (&opts);
+        }
+        /* status never listens, a node it has no record of is unknown */
+        if ((opts.nsockets == 0) &&
+            ((opts.daemon != 0) ||
+             ((opts.control < 0) && (opts.action != FENCE_KDUMP_ACTION_STATUS))) &&
+            (get_options_receive (&opts) != 0)) {
+            log_error (0, "failed to listen on port '%d'\n", opts.ipport);
+            exit (1);
+        }
+
+        if (get_options_key (&opts) != 0) {
+            log_error (0, "failed to read key file '%s'\n", opts.keyfile);
             exit (1);
         }
-        if (get_options_node (&opts) != 0) {
-            log_error (0, "failed to get node '%s'\n", opts.nodename);
+
+        if ((opts.daemon == 0) && (get_options_nodes (&opts) != 0)) {
+            log_error (0, "failed to get nodes '%s'\n", opts.nodename);
             exit (1);
         }
+
+        get_options_filter (&opts);
+    }
+
+    /* the journal only helps diagnose, fencing goes on without it */
+    if ((opts.journalpath != NULL) && ((opts.nsockets > 0) || (opts.ring.sock >= 0)) &&
+        (open_journal (&opts.journal, opts.journalpath) != 0)) {
+        log_error (0, "failed to open journal '%s' (%s)\n",
+                   opts.journalpath, strerror (errno));
     }
 
     if (verbose != 0) {
+        log_flush ();
         print_options (&opts);
     }
 
+    if (opts.daemon != 0) {
+        error = do_action_daemon (&opts);
+        free_options (&opts);
+        return (error);
+    }
+
     switch (opts.action) {
     case FENCE_KDUMP_ACTION_OFF:
-        error = do_action_off (&opts);
+        if (opts.control >= 0) {
+            error = do_action_off_query (&opts);
+        } else if (opts.seenpath != NULL) {
+            read_replay_nodes (&opts);
+            error = do_action_off (&opts);
+            save_seen_nodes (&opts);
+        } else {
+            error = do_action_off (&opts);
+        }
+        break;
+    case FENCE_KDUMP_ACTION_STATUS:
+        error = do_action_status (&opts);
+        break;
+    case FENCE_KDUMP_ACTION_MONITOR:
+        error = do_action_monitor (&opts);
         break;
     case FENCE_KDUMP_ACTION_METADATA:
-        error = do_action_metadata (argv[0]);
+        error = print_opts_metadata (&options_table, argv[0]);
         break;
     default:
         break;
@@ -0,0 +1,767 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*-
+ *
+ * Copyright (c) Ryan O'Hara (rohara@redhat.com)
+ * Copyright (c) Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+/*
+ * Loopback load generator for the receive path of fence_kdump. Each
+ * trial starts "fence_kdump -o off" for 127.0.0.1 and floods its port
+ * with messages of a bad magic, of an unknown version, and valid ones
+ * from the wrong sender (127.0.0.2). After a while valid messages from
+ * 127.0.0.1 are mixed in. The agent reports, with its verdict, how long
+ * the accepted message took since it was stamped (send_ns) and since
+ * the kernel received it (wire_ns); these are collected over all
+ * trials, along with the CPU time the agent used.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <arpa/inet.h>
+
+#include "options.h"
+#include "message.h"
+#include "version.h"
+
+static int verbose = 0;
+
+#define log_debug(lvl, fmt, args...)               \
+do {                                               \
+    if (lvl <= verbose)                            \
+        fprintf (stdout, "[debug]: " fmt, ##args); \
+} while (0);
+
+#define log_error(lvl, fmt, args...)               \
+do {                                               \
+    if (lvl <= verbose)                            \
+        fprintf (stderr, "[error]: " fmt, ##args); \
+} while (0);
+
+#define FENCE_KDUMP_BENCH_PORT     17410
+#define FENCE_KDUMP_BENCH_TRIALS   20
+#define FENCE_KDUMP_BENCH_DURATION 200
+#define FENCE_KDUMP_BENCH_TIMEOUT  5
+#define FENCE_KDUMP_BENCH_RATE     100000
+#define FENCE_KDUMP_BENCH_VALID    100
+
+/* the agent is allowed this long to bind its port */
+#define FENCE_KDUMP_BENCH_START    2000
+
+/* a sender that falls this far behind skips ahead instead of catching up */
+#define FENCE_KDUMP_BENCH_LAG      100000000LL
+
+#define FENCE_KDUMP_BENCH_OUTPUT   4096
+
+enum {
+    FENCE_KDUMP_BENCH_VALID_MSG = 0,
+    FENCE_KDUMP_BENCH_MAGIC,
+    FENCE_KDUMP_BENCH_VERSION,
+    FENCE_KDUMP_BENCH_SENDER,
+    FENCE_KDUMP_BENCH_KINDS,
+};
+
+static const char *kind_names[FENCE_KDUMP_BENCH_KINDS] = {
+    "valid", "magic", "version", "sender",
+};
+
+/*
+ * One kind of message, sent at a fixed rate from its own socket. Only
+ * valid messages are signed for every send; the others never get as
+ * far as the digest check.
+ */
+typedef struct fence_kdump_bench_kind {
+    long rate;
+    int64_t next;
+    uint64_t sent;
+    int sock;
+    fence_kdump_msg_v2_t msg;
+} fence_kdump_bench_kind_t;
+
+typedef struct fence_kdump_bench {
+    const char *agent;
+    const char *keyfile;
+    int ipport;
+    int trials;
+    int duration;
+    int timeout;
+    hmac_ctx_t hmac;
+    struct sockaddr_in dest;
+    fence_kdump_bench_kind_t kind[FENCE_KDUMP_BENCH_KINDS];
+    uint64_t seq;
+    int64_t *verdict_ns;
+    int64_t *wire_ns;
+    int verdicts;
+    int64_t cpu_ns;
+    int64_t base_cpu_ns;
+    uint64_t packets;
+} fence_kdump_bench_t;
+
+static int64_t
+get_time_ns (clockid_t clock)
+{
+    struct timespec ts;
+
+    clock_gettime (clock, &ts);
+
+    return ((int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec);
+}
+
+static int
+open_sender (const char *addr)
+{
+    int sock;
+    struct sockaddr_in sin;
+
+    sock = socket (AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sock < 0) {
+        log_error (0, "socket (%s)\n", strerror (errno));
+        return (-1);
+    }
+
+    memset (&sin, 0, sizeof (sin));
+    sin.sin_family = AF_INET;
+    inet_pton (AF_INET, addr, &sin.sin_addr);
+
+    if (bind (sock, (struct sockaddr *) &sin, sizeof (sin)) != 0) {
+        log_error (0, "bind '%s' (%s)\n", addr, strerror (errno));
+        close (sock);
+        return (-1);
+    }
+
+    return (sock);
+}
+
+static int
+init_bench (fence_kdump_bench_t *bench)
+{
+    int i;
+    uint8_t boot_id[FENCE_KDUMP_BOOT_ID_LEN];
+    fence_kdump_bench_kind_t *kind;
+
+    memset (bench->dest.sin_zero, 0, sizeof (bench->dest.sin_zero));
+    bench->dest.sin_family = AF_INET;
+    bench->dest.sin_port = htons (bench->ipport);
+    bench->dest.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+
+    bench->verdict_ns = calloc (bench->trials, sizeof (int64_t));
+    bench->wire_ns = calloc (bench->trials, sizeof (int64_t));
+    if (!bench->verdict_ns || !bench->wire_ns) {
+        log_error (0, "calloc (%s)\n", strerror (errno));
+        return (1);
+    }
+
+    for (i = 0; i < FENCE_KDUMP_BOOT_ID_LEN; i++) {
+        boot_id[i] = (uint8_t) rand ();
+    }
+
+    for (i = 0; i < FENCE_KDUMP_BENCH_KINDS; i++) {
+        kind = &bench->kind[i];
+        kind->sock = open_sender ((i == FENCE_KDUMP_BENCH_SENDER) ? "127.0.0.2" : "127.0.0.1");
+        if (kind->sock < 0) {
+            return (1);
+        }
+        init_message_v2 (&kind->msg, "bench", boot_id);
+    }
+
+    kind = &bench->kind[FENCE_KDUMP_BENCH_MAGIC];
+    kind->msg.magic = ~FENCE_KDUMP_MAGIC;
+
+    kind = &bench->kind[FENCE_KDUMP_BENCH_VERSION];
+    kind->msg.version = FENCE_KDUMP_MSGV2 + 1;
+
+    return (0);
+}
+
+static void
+free_bench (fence_kdump_bench_t *bench)
+{
+    int i;
+
+    for (i = 0; i < FENCE_KDUMP_BENCH_KINDS; i++) {
+        if (bench->kind[i].sock >= 0) {
+            close (bench->kind[i].sock);
+        }
+    }
+
+    free (bench->verdict_ns);
+    free (bench->wire_ns);
+}
+
+static void
+sign_bench_message (fence_kdump_bench_t *bench, fence_kdump_msg_v2_t *msg)
+{
+    fence_kdump_progress_t progress = { FENCE_KDUMP_STAGE_BOOT, 0, 0 };
+
+    sign_message_v2 (msg, &bench->hmac, ++bench->seq,
+                     (uint64_t) get_time_ns (CLOCK_REALTIME), &progress);
+}
+
+/*
+ * Sends every message of one kind that is due by now, in one
+ * sendmmsg() per batch. Messages the socket buffer had no room for
+ * are not counted; the rate is what the receiver was offered.
+ */
+static void
+send_kind (fence_kdump_bench_t *bench, fence_kdump_bench_kind_t *kind, int64_t now)
+{
+    int i;
+    int n = 0;
+    int sent;
+    int64_t step;
+    struct iovec iov;
+    struct mmsghdr hdr[FENCE_KDUMP_BATCH];
+
+    if ((kind->rate <= 0) || (kind->next > now)) {
+        return;
+    }
+
+    step = 1000000000LL / kind->rate;
+    if (kind->next < now - FENCE_KDUMP_BENCH_LAG) {
+        kind->next = now;
+    }
+
+    if (kind == &bench->kind[FENCE_KDUMP_BENCH_VALID_MSG]) {
+        sign_bench_message (bench, &kind->msg);
+    }
+
+    iov.iov_base = &kind->msg;
+    iov.iov_len = sizeof (kind->msg);
+
+    while ((kind->next <= now) && (n < FENCE_KDUMP_BATCH)) {
+        memset (&hdr[n], 0, sizeof (hdr[n]));
+        hdr[n].msg_hdr.msg_name = &bench->dest;
+        hdr[n].msg_hdr.msg_namelen = sizeof (bench->dest);
+        hdr[n].msg_hdr.msg_iov = &iov;
+        hdr[n].msg_hdr.msg_iovlen = 1;
+        kind->next += step;
+        n++;
+    }
+
+    for (i = 0; i < n; i += sent) {
+        sent = sendmmsg (kind->sock, &hdr[i], n - i, 0);
+        if (sent <= 0) {
+            break;
+        }
+        kind->sent += sent;
+    }
+}
+
+/* The earliest time a kind is due to send, but at least once a millisecond. */
+static int64_t
+next_due (const fence_kdump_bench_t *bench, int noise, int64_t now)
+{
+    int i;
+    int64_t next = now + 1000000LL;
+
+    for (i = 0; i < FENCE_KDUMP_BENCH_KINDS; i++) {
+        if ((i != FENCE_KDUMP_BENCH_VALID_MSG) && (noise == 0)) {
+            continue;
+        }
+        if ((bench->kind[i].rate > 0) && (bench->kind[i].next < next)) {
+            next = bench->kind[i].next;
+        }
+    }
+
+    return (next);
+}
+
+static uint64_t
+count_sent (const fence_kdump_bench_t *bench)
+{
+    int i;
+    uint64_t sent = 0;
+
+    for (i = 0; i < FENCE_KDUMP_BENCH_KINDS; i++) {
+        sent += bench->kind[i].sent;
+    }
+
+    return (sent);
+}
+
+static pid_t
+start_agent (const fence_kdump_bench_t *bench, int *out)
+{
+    pid_t pid;
+    int fds[2];
+    char port[8];
+    char timeout[16];
+    char sockpath[64];
+
+    snprintf (port, sizeof (port), "%d", bench->ipport);
+    snprintf (timeout, sizeof (timeout), "%d", bench->timeout);
+    /* a query socket that does not exist, so the agent listens itself */
+    snprintf (sockpath, sizeof (sockpath), "/nonexistent/fence_kdump_bench.%d", (int) getpid ());
+
+    if (pipe2 (fds, O_CLOEXEC) != 0) {
+        log_error (0, "pipe (%s)\n", strerror (errno));
+        return (-1);
+    }
+
+    pid = fork ();
+    if (pid < 0) {
+        log_error (0, "fork (%s)\n", strerror (errno));
+        close (fds[0]);
+        close (fds[1]);
+        return (-1);
+    }
+
+    if (pid == 0) {
+        dup2 (fds[1], STDOUT_FILENO);
+        if (bench->keyfile != NULL) {
+            execl (bench->agent, bench->agent, "-o", "off", "-n", "127.0.0.1",
+                   "-f", "ipv4", "-p", port, "-t", timeout, "-S", sockpath,
+                   "-k", bench->keyfile, (char *) NULL);
+        } else {
+            execl (bench->agent, bench->agent, "-o", "off", "-n", "127.0.0.1",
+                   "-f", "ipv4", "-p", port, "-t", timeout, "-S", sockpath,
+                   (char *) NULL);
+        }
+        fprintf (stderr, "[error]: exec '%s' (%s)\n", bench->agent, strerror (errno));
+        _exit (127);
+    }
+
+    close (fds[1]);
+    *out = fds[0];
+
+    return (pid);
+}
+
+/* The port is taken once binding it without SO_REUSEADDR fails. */
+static int
+wait_agent (const fence_kdump_bench_t *bench, pid_t pid)
+{
+    int sock;
+    int error;
+    int64_t end;
+    struct sockaddr_in sin;
+    struct timespec delay = { 0, 1000000L };
+
+    end = get_time_ns (CLOCK_MONOTONIC) + FENCE_KDUMP_BENCH_START * 1000000LL;
+
+    memset (&sin, 0, sizeof (sin));
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons (bench->ipport);
+
+    while (get_time_ns (CLOCK_MONOTONIC) < end) {
+        if (waitpid (pid, NULL, WNOHANG) != 0) {
+            return (1);
+        }
+        sock = socket (AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if (sock < 0) {
+            return (1);
+        }
+        error = bind (sock, (struct sockaddr *) &sin, sizeof (sin));
+        close (sock);
+        if ((error != 0) && (errno == EADDRINUSE)) {
+            return (0);
+        }
+        nanosleep (&delay, NULL);
+    }
+
+    return (1);
+}
+
+/* Takes "latency node=... wire_ns=N send_ns=N" from the agent output. */
+static int
+read_verdict (int fd, int64_t *verdict_ns, int64_t *wire_ns)
+{
+    ssize_t n;
+    size_t len = 0;
+    char *p;
+    char buf[FENCE_KDUMP_BENCH_OUTPUT];
+    long long value;
+
+    while ((len < sizeof (buf) - 1) && ((n = read (fd, buf + len, sizeof (buf) - 1 - len)) > 0)) {
+        len += n;
+    }
+    buf[len] = 0;
+
+    if (verbose > 1) {
+        fputs (buf, stdout);
+    }
+
+    p = strstr (buf, "latency node=");
+    if (p == NULL) {
+        return (1);
+    }
+
+    *wire_ns = -1;
+    if ((strstr (p, "wire_ns=") != NULL) &&
+        (sscanf (strstr (p, "wire_ns="), "wire_ns=%lld", &value) == 1)) {
+        *wire_ns = value;
+    }
+
+    if ((strstr (p, "send_ns=") == NULL) ||
+        (sscanf (strstr (p, "send_ns="), "send_ns=%lld", &value) != 1)) {
+        return (1);
+    }
+    *verdict_ns = value;
+
+    return (0);
+}
+
+/*
+ * Runs the agent once. Noise is sent from the start, valid messages
+ * only after the configured duration, and both until the agent exits.
+ * Returns 0 if it reported a verdict.
+ */
+static int
+run_trial (fence_kdump_bench_t *bench, int trial, int noise)
+{
+    int i;
+    int fd;
+    int status;
+    int error;
+    pid_t pid;
+    int64_t now;
+    int64_t next;
+    uint64_t sent;
+    int64_t *verdict_ns = &bench->verdict_ns[bench->verdicts];
+    struct timespec until;
+
+    pid = start_agent (bench, &fd);
+    if (pid < 0) {
+        return (1);
+    }
+
+    if (wait_agent (bench, pid) != 0) {
+        log_error (0, "agent did not start listening on port '%d'\n", bench->ipport);
+        kill (pid, SIGTERM);
+        waitpid (pid, NULL, 0);
+        close (fd);
+        return (1);
+    }
+
+    sent = count_sent (bench);
+
+    now = get_time_ns (CLOCK_MONOTONIC);
+    for (i = 0; i < FENCE_KDUMP_BENCH_KINDS; i++) {
+        bench->kind[i].next = now;
+    }
+    bench->kind[FENCE_KDUMP_BENCH_VALID_MSG].next += (int64_t) bench->duration * 1000000LL;
+
+    while (waitpid (pid, &status, WNOHANG) == 0) {
+        now = get_time_ns (CLOCK_MONOTONIC);
+
+        for (i = 0; i < FENCE_KDUMP_BENCH_KINDS; i++) {
+            if ((i == FENCE_KDUMP_BENCH_VALID_MSG) || (noise != 0)) {
+                send_kind (bench, &bench->kind[i], now);
+            }
+        }
+
+        next = next_due (bench, noise, now);
+        if (next > now) {
+            until.tv_sec = next / 1000000000LL;
+            until.tv_nsec = next % 1000000000LL;
+            clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL);
+        }
+    }
+
+    sent = count_sent (bench) - sent;
+
+    error = read_verdict (fd, verdict_ns, &bench->wire_ns[bench->verdicts]);
+    close (fd);
+
+    if ((error != 0) || !WIFEXITED (status) || (WEXITSTATUS (status) != 0)) {
+        log_debug (1, "trial %d: no verdict\n", trial);
+        return (1);
+    }
+
+    log_debug (1, "trial %d: verdict after %lld ns, %llu messages\n", trial,
+               (long long) *verdict_ns, (unsigned long long) sent);
+
+    if (noise != 0) {
+        bench->packets += sent;
+        bench->verdicts++;
+    }
+
+    return (0);
+}
+
+static int
+compare_ns (const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *) a;
+    int64_t y = *(const int64_t *) b;
+
+    return ((x > y) - (x < y));
+}
+
+/* nearest rank of a sorted set */
+static int64_t
+get_percentile (const int64_t *ns, int n, int p)
+{
+    return (ns[(p * n + 99) / 100 - 1]);
+}
+
+static void
+print_percentiles (const char *name, int64_t *ns, int n)
+{
+    if (n == 0) {
+        return;
+    }
+
+    qsort (ns, n, sizeof (int64_t), compare_ns);
+
+    fprintf (stdout, "%s p50_ns=%lld p90_ns=%lld p99_ns=%lld max_ns=%lld\n", name,
+             (long long) get_percentile (ns, n, 50), (long long) get_percentile (ns, n, 90),
+             (long long) get_percentile (ns, n, 99), (long long) ns[n - 1]);
+}
+
+static void
+print_results (fence_kdump_bench_t *bench)
+{
+    int i;
+    int n = 0;
+    int64_t cpu_ns;
+
+    fprintf (stdout, "trials=%d verdicts=%d", bench->trials, bench->verdicts);
+    for (i = 0; i < FENCE_KDUMP_BENCH_KINDS; i++) {
+        fprintf (stdout, " %s=%llu", kind_names[i], (unsigned long long) bench->kind[i].sent);
+    }
+    fprintf (stdout, "\n");
+
+    print_percentiles ("verdict", bench->verdict_ns, bench->verdicts);
+
+    for (i = 0; i < bench->verdicts; i++) {
+        if (bench->wire_ns[i] >= 0) {
+            bench->wire_ns[n++] = bench->wire_ns[i];
+        }
+    }
+    print_percentiles ("queue", bench->wire_ns, n);
+
+    /* what the agent spends per message, less what starting it costs */
+    cpu_ns = bench->cpu_ns - bench->base_cpu_ns * bench->trials;
+    if ((bench->packets > 0) && (cpu_ns > 0)) {
+        fprintf (stdout, "cpu_ns=%lld base_cpu_ns=%lld cpu_ms_per_mpkt=%.3f\n",
+                 (long long) bench->cpu_ns, (long long) bench->base_cpu_ns,
+                 (double) cpu_ns / 1e6 / ((double) bench->packets / 1e6));
+    }
+}
+
+/* CPU time of all agents waited for so far. */
+static int64_t
+get_children_ns (void)
+{
+    struct rusage ru;
+
+    getrusage (RUSAGE_CHILDREN, &ru);
+
+    return (((int64_t) ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000000LL +
+            ((int64_t) ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1000LL);
+}
+
+static long
+get_rate (const char *arg)
+{
+    char *end;
+    long rate;
+
+    rate = strtol (arg, &end, 10);
+    if ((*end != 0) || (rate < 0) || (rate > 1000000000L)) {
+        fprintf (stderr, "[error]: invalid rate '%s'\n", arg);
+        exit (1);
+    }
+
+    return (rate);
+}
+
+static void
+print_usage (const char *self)
+{
+    fprintf (stdout, "Usage: %s [options]\n", basename (self));
+    fprintf (stdout, "\n");
+    fprintf (stdout, "Options:\n");
+    fprintf (stdout, "\n");
+    fprintf (stdout, "%s\n",
+             "  -a, --agent=PATH             fence_kdump to run (default: ./fence_kdump)");
+    fprintf (stdout, "%s\n",
+             "  -p, --ipport=PORT            Port number (default: 17410)");
+    fprintf (stdout, "%s\n",
+             "  -k, --key-file=FILE          File containing the shared message key");
+    fprintf (stdout, "%s\n",
+             "  -n, --trials=COUNT           Number of times the agent is run (default: 20)");
+    fprintf (stdout, "%s\n",
+             "  -d, --duration=MSEC          Noise sent before valid messages (default: 200)");
+    fprintf (stdout, "%s\n",
+             "  -t, --timeout=SECONDS        Agent timeout per trial (default: 5)");
+    fprintf (stdout, "%s\n",
+             "  -R, --valid-rate=RATE        Valid messages per second (default: 100)");
+    fprintf (stdout, "%s\n",
+             "  -M, --magic-rate=RATE        Messages with a bad magic per second (default: 100000)");
+    fprintf (stdout, "%s\n",
+             "  -W, --version-rate=RATE      Messages of an unknown version per second (default: 100000)");
+    fprintf (stdout, "%s\n",
+             "  -S, --sender-rate=RATE       Messages from the wrong sender per second (default: 100000)");
+    fprintf (stdout, "%s\n",
+             "  -v, --verbose                Print each trial, twice for the agent output");
+    fprintf (stdout, "%s\n",
+             "  -V, --version                Print version");
+    fprintf (stdout, "%s\n",
+             "  -h, --help                   Print usage");
+    fprintf (stdout, "\n");
+
+    return;
+}
+
+int
+main (int argc, char **argv)
+{
+    int i;
+    int opt;
+    int64_t cpu_ns;
+    fence_kdump_opts_t opts;
+    fence_kdump_bench_t bench;
+
+    struct option options[] = {
+        { "agent",        required_argument, NULL, 'a' },
+        { "ipport",       required_argument, NULL, 'p' },
+        { "key-file",     required_argument, NULL, 'k' },
+        { "trials",       required_argument, NULL, 'n' },
+        { "duration",     required_argument, NULL, 'd' },
+        { "timeout",      required_argument, NULL, 't' },
+        { "valid-rate",   required_argument, NULL, 'R' },
+        { "magic-rate",   required_argument, NULL, 'M' },
+        { "version-rate", required_argument, NULL, 'W' },
+        { "sender-rate",  required_argument, NULL, 'S' },
+        { "verbose",      optional_argument, NULL, 'v' },
+        { "version",      no_argument,       NULL, 'V' },
+        { "help",         no_argument,       NULL, 'h' },
+        { 0, 0, 0, 0 }
+    };
+
+    memset (&bench, 0, sizeof (bench));
+    bench.agent = "./fence_kdump";
+    bench.ipport = FENCE_KDUMP_BENCH_PORT;
+    bench.trials = FENCE_KDUMP_BENCH_TRIALS;
+    bench.duration = FENCE_KDUMP_BENCH_DURATION;
+    bench.timeout = FENCE_KDUMP_BENCH_TIMEOUT;
+    bench.kind[FENCE_KDUMP_BENCH_VALID_MSG].rate = FENCE_KDUMP_BENCH_VALID;
+    bench.kind[FENCE_KDUMP_BENCH_MAGIC].rate = FENCE_KDUMP_BENCH_RATE;
+    bench.kind[FENCE_KDUMP_BENCH_VERSION].rate = FENCE_KDUMP_BENCH_RATE;
+    bench.kind[FENCE_KDUMP_BENCH_SENDER].rate = FENCE_KDUMP_BENCH_RATE;
+    for (i = 0; i < FENCE_KDUMP_BENCH_KINDS; i++) {
+        bench.kind[i].sock = -1;
+    }
+
+    init_options (&opts);
+
+    while ((opt = getopt_long (argc, argv, "a:p:k:n:d:t:R:M:W:S:v::Vh", options, NULL)) != EOF) {
+        switch (opt) {
+        case 'a':
+            bench.agent = optarg;
+            break;
+        case 'p':
+            set_option_ipport (&opts, optarg);
+            bench.ipport = opts.ipport;
+            break;
+        case 'k':
+            bench.keyfile = optarg;
+            set_option_keyfile (&opts, optarg);
+            break;
+        case 'n':
+            bench.trials = atoi (optarg);
+            break;
+        case 'd':
+            bench.duration = atoi (optarg);
+            break;
+        case 't':
+            bench.timeout = atoi (optarg);
+            break;
+        case 'R':
+            bench.kind[FENCE_KDUMP_BENCH_VALID_MSG].rate = get_rate (optarg);
+            break;
+        case 'M':
+            bench.kind[FENCE_KDUMP_BENCH_MAGIC].rate = get_rate (optarg);
+            break;
+        case 'W':
+            bench.kind[FENCE_KDUMP_BENCH_VERSION].rate = get_rate (optarg);
+            break;
+        case 'S':
+            bench.kind[FENCE_KDUMP_BENCH_SENDER].rate = get_rate (optarg);
+            break;
+        case 'v':
+            verbose = (optarg != NULL) ? atoi (optarg) : verbose + 1;
+            break;
+        case 'V':
+            print_version (argv[0]);
+            exit (0);
+        case 'h':
+            print_usage (argv[0]);
+            exit (0);
+        default:
+            print_usage (argv[0]);
+            exit (1);
+        }
+    }
+
+    if ((optind != argc) || (bench.trials <= 0) || (bench.duration < 0) ||
+        (bench.timeout <= 0) || (bench.kind[FENCE_KDUMP_BENCH_VALID_MSG].rate == 0)) {
+        print_usage (argv[0]);
+        exit (1);
+    }
+
+    if (get_options_key (&opts) != 0) {
+        exit (1);
+    }
+    bench.hmac = opts.hmac;
+    free_options (&opts);
+
+    srand ((unsigned int) get_time_ns (CLOCK_REALTIME));
+
+    if (init_bench (&bench) != 0) {
+        free_bench (&bench);
+        exit (1);
+    }
+
+    /* one quiet run for what starting the agent and a verdict cost */
+    cpu_ns = get_children_ns ();
+    if (run_trial (&bench, 0, 0) != 0) {
+        log_error (0, "agent '%s' gave no verdict without load\n", bench.agent);
+        free_bench (&bench);
+        exit (1);
+    }
+    bench.base_cpu_ns = get_children_ns () - cpu_ns;
+    for (i = 0; i < FENCE_KDUMP_BENCH_KINDS; i++) {
+        bench.kind[i].sent = 0;
+    }
+
+    cpu_ns = get_children_ns ();
+    for (i = 1; i <= bench.trials; i++) {
+        run_trial (&bench, i, 1);
+    }
+    bench.cpu_ns = get_children_ns () - cpu_ns;
+
+    print_results (&bench);
+
+    free_bench (&bench);
+
+    return ((bench.verdicts == bench.trials) ? 0 : 1);
+}
@@ -0,0 +1,226 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*-
+ *
+ * Copyright (c) Ryan O'Hara (rohara@redhat.com)
+ * Copyright (c) Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+/*
+ * Fuzz target for the message checks of fence_kdump. The agent is
+ * built in, with its main() renamed, so the datagram takes the same
+ * read_message() and check_message() path as in read_socket().
+ *
+ * The first byte of an input selects the policy and the sender:
+ *
+ *   bit 0  a key is configured
+ *   bit 1  version 1 messages are allowed with a key
+ *   bit 2  the message comes from the node being waited for
+ *   bit 3  a version 2 message is signed with the key before the check
+ *
+ * and the rest is the datagram. Signing lets the fuzzer get past the
+ * digest to the timestamp, sequence number and progress checks.
+ *
+ * Built with -DFENCE_KDUMP_LIBFUZZER and -fsanitize=fuzzer this is a
+ * libFuzzer target. Otherwise it has a main() that runs each file given
+ * on the command line, or stdin, once, to replay a corpus or a crash.
+ */
+
+#define main fence_kdump_main
+int main (int argc, char **argv);
+#include "fence_kdump.c"
+#undef main
+
+#define FENCE_KDUMP_FUZZ_KEY  "fence_kdump_fuzz"
+#define FENCE_KDUMP_FUZZ_NODE "node1"
+
+#define FENCE_KDUMP_FUZZ_KEYED   0x1
+#define FENCE_KDUMP_FUZZ_ALLOWV1 0x2
+#define FENCE_KDUMP_FUZZ_KNOWN   0x4
+#define FENCE_KDUMP_FUZZ_SIGN    0x8
+
+int LLVMFuzzerTestOneInput (const uint8_t *data, size_t size);
+
+static fence_kdump_opts_t fuzz_opts;
+static hmac_ctx_t fuzz_hmac[2];
+
+static void
+set_fuzz_addr (struct sockaddr_storage *ss, int family, const char *addr)
+{
+    struct sockaddr_in *sin = (struct sockaddr_in *) ss;
+    struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *) ss;
+
+    memset (ss, 0, sizeof (*ss));
+    ss->ss_family = family;
+
+    if (family == AF_INET) {
+        sin->sin_port = htons (FENCE_KDUMP_DEFAULT_IPPORT);
+        inet_pton (AF_INET, addr, &sin->sin_addr);
+    } else {
+        sin6->sin6_port = htons (FENCE_KDUMP_DEFAULT_IPPORT);
+        inet_pton (AF_INET6, addr, &sin6->sin6_addr);
+    }
+}
+
+/* One node, known by an IPv4 and an IPv6 address, as if resolved. */
+static int
+init_fuzz (void)
+{
+    fence_kdump_resolve_t res;
+
+    verbose = -1;
+
+    init_options (&fuzz_opts);
+
+    if (alloc_nodes (&fuzz_opts.nodes, 1) != 0) {
+        return (1);
+    }
+
+    memset (&res, 0, sizeof (res));
+    res.name = FENCE_KDUMP_FUZZ_NODE;
+    res.count = 2;
+    set_fuzz_addr (&res.addr[0], AF_INET, "127.0.0.1");
+    set_fuzz_addr (&res.addr[1], AF_INET6, "::1");
+
+    if (get_options_node (&fuzz_opts, &res) != 0) {
+        return (1);
+    }
+
+    hmac_init (&fuzz_hmac[0], NULL, 0);
+    hmac_init (&fuzz_hmac[1], FENCE_KDUMP_FUZZ_KEY, strlen (FENCE_KDUMP_FUZZ_KEY));
+
+    return (0);
+}
+
+int
+LLVMFuzzerTestOneInput (const uint8_t *data, size_t size)
+{
+    static int initialized = 0;
+    uint8_t flags;
+    uint16_t port;
+    int verdict;
+    fence_kdump_addr_t addr;
+    fence_kdump_node_t *node;
+    fence_kdump_msg_buf_t msg;
+    struct sockaddr_storage from;
+    struct mmsghdr hdr;
+    struct timespec rx;
+
+    if (initialized == 0) {
+        if (init_fuzz () != 0) {
+            abort ();
+        }
+        initialized = 1;
+    }
+
+    if (size == 0) {
+        return (0);
+    }
+
+    flags = data[0];
+    data++;
+    size--;
+
+    fuzz_opts.keyed = ((flags & FENCE_KDUMP_FUZZ_KEYED) != 0);
+    fuzz_opts.allow_v1 = ((flags & FENCE_KDUMP_FUZZ_ALLOWV1) != 0);
+    fuzz_opts.hmac = fuzz_hmac[fuzz_opts.keyed];
+
+    /* every input starts from a node that has not been heard from */
+    for_each_node (node, &fuzz_opts.nodes) {
+        node->fenced = 0;
+        node->seq = 0;
+        memset (node->boot_id, 0, sizeof (node->boot_id));
+    }
+    fuzz_opts.pending = fuzz_opts.nodes.count;
+
+    /* what recvmmsg() would have left in the batch slot */
+    memset (&msg, 0, sizeof (msg));
+    memcpy (&msg, data, (size < sizeof (msg)) ? size : sizeof (msg));
+
+    if (((flags & FENCE_KDUMP_FUZZ_SIGN) != 0) && (size == sizeof (msg.v2))) {
+        hmac_digest (&fuzz_opts.hmac, &msg.v2, offsetof (fence_kdump_msg_v2_t, hmac),
+                     msg.v2.hmac, sizeof (msg.v2.hmac));
+    }
+
+    set_fuzz_addr (&from, AF_INET,
+                   ((flags & FENCE_KDUMP_FUZZ_KNOWN) != 0) ? "127.0.0.1" : "192.0.2.1");
+
+    memset (&hdr, 0, sizeof (hdr));
+    hdr.msg_hdr.msg_name = &from;
+    hdr.msg_hdr.msg_namelen = sizeof (struct sockaddr_in);
+    hdr.msg_len = (size < sizeof (msg)) ? size : sizeof (msg);
+    if (size > sizeof (msg)) {
+        hdr.msg_hdr.msg_flags = MSG_TRUNC;
+    }
+
+    verdict = read_message (&hdr, &addr, &port, &rx);
+    if (verdict == FENCE_KDUMP_VERDICT_ACCEPT) {
+        verdict = check_message (&fuzz_opts, &msg, hdr.msg_len, &addr, &rx);
+    }
+
+    /* a message is accepted exactly when the node is marked */
+    if ((verdict == FENCE_KDUMP_VERDICT_ACCEPT) != (fuzz_opts.pending == 0)) {
+        abort ();
+    }
+
+    return (0);
+}
+
+#ifndef FENCE_KDUMP_LIBFUZZER
+
+static int
+run_fuzz_file (FILE *fp, const char *name)
+{
+    size_t len;
+    uint8_t buf[1 + sizeof (fence_kdump_msg_buf_t) + 1];
+
+    len = fread (buf, 1, sizeof (buf), fp);
+    if (ferror (fp)) {
+        fprintf (stderr, "[error]: failed to read '%s' (%s)\n", name, strerror (errno));
+        return (1);
+    }
+
+    LLVMFuzzerTestOneInput (buf, len);
+
+    return (0);
+}
+
+int
+main (int argc, char **argv)
+{
+    int i;
+    int error = 0;
+    FILE *fp;
+
+    if (argc < 2) {
+        return (run_fuzz_file (stdin, "stdin"));
+    }
+
+    for (i = 1; i < argc; i++) {
+        fp = fopen (argv[i], "r");
+        if (fp == NULL) {
+            fprintf (stderr, "[error]: failed to open '%s' (%s)\n", argv[i], strerror (errno));
+            error = 1;
+            continue;
+        }
+        error |= run_fuzz_file (fp, argv[i]);
+        fclose (fp);
+    }
+
+    return (error);
+}
+
+#endif
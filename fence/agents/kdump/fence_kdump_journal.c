@@ -0,0 +1,204 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*-
+ *
+ * Copyright (c) Ryan O'Hara (rohara@redhat.com)
+ * Copyright (c) Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+#include "journal.h"
+#include "version.h"
+
+static int verbose = 0;
+
+#define FENCE_KDUMP_FOLLOW_INTERVAL 100
+
+#define log_error(lvl, fmt, args...)               \
+do {                                               \
+    if (lvl <= verbose)                            \
+        fprintf (stderr, "[error]: " fmt, ##args); \
+} while (0);
+
+static void
+print_entry (const fence_kdump_journal_entry_t *entry)
+{
+    time_t sec;
+    struct tm tm;
+    char date[32];
+    char addr[INET6_ADDRSTRLEN];
+    char node[FENCE_KDUMP_NODE_ID_LEN + 1];
+
+    sec = (time_t) (entry->time / 1000000000ULL);
+    localtime_r (&sec, &tm);
+    strftime (date, sizeof (date), "%Y-%m-%dT%H:%M:%S", &tm);
+
+    memcpy (node, entry->node, sizeof (entry->node));
+    node[sizeof (entry->node)] = 0;
+
+    fprintf (stdout, "time=%s.%09llu addr=%s port=%u version=%u",
+             date, (unsigned long long) (entry->time % 1000000000ULL),
+             print_addr (&entry->addr, addr, sizeof (addr)),
+             entry->port, entry->version);
+
+    if (node[0] != 0) {
+        fprintf (stdout, " node=%s seq=%llu stage=%s",
+                 node, (unsigned long long) entry->msgseq,
+                 stage_name (entry->stage));
+    }
+
+    fprintf (stdout, " verdict=%s\n", verdict_name (entry->verdict));
+}
+
+/*
+ * Print entries from next up to the current head and return the new
+ * position. Entries that were overwritten before they could be read
+ * are counted as lost.
+ */
+static uint64_t
+dump_journal (const fence_kdump_journal_t *journal, uint64_t next)
+{
+    uint64_t head;
+    fence_kdump_journal_entry_t entry;
+
+    head = __atomic_load_n (&journal->head->head, __ATOMIC_ACQUIRE);
+
+    if (head - next > journal->head->slots) {
+        log_error (1, "lost %llu entries\n",
+                   (unsigned long long) (head - next - journal->head->slots));
+        next = head - journal->head->slots;
+    }
+
+    for (; next < head; next++) {
+        if (get_journal_entry (journal, next, &entry) != 0) {
+            log_error (1, "lost entry %llu\n", (unsigned long long) next + 1);
+            continue;
+        }
+        print_entry (&entry);
+    }
+
+    fflush (stdout);
+
+    return (next);
+}
+
+static void
+print_usage (const char *self)
+{
+    fprintf (stdout, "Usage: %s [options] FILE\n", basename (self));
+    fprintf (stdout, "\n");
+    fprintf (stdout, "Options:\n");
+    fprintf (stdout, "\n");
+    fprintf (stdout, "%s\n",
+             "  -c, --count=COUNT            Print only the last COUNT entries");
+    fprintf (stdout, "%s\n",
+             "  -f, --follow                 Keep printing entries as they are written");
+    fprintf (stdout, "%s\n",
+             "  -v, --verbose                Report entries lost to the writer");
+    fprintf (stdout, "%s\n",
+             "  -V, --version                Print version");
+    fprintf (stdout, "%s\n",
+             "  -h, --help                   Print usage");
+    fprintf (stdout, "\n");
+
+    return;
+}
+
+int
+main (int argc, char **argv)
+{
+    int opt;
+    int follow = 0;
+    long count = -1;
+    uint64_t head;
+    uint64_t next;
+    fence_kdump_journal_t journal;
+    struct timespec delay;
+
+    struct option options[] = {
+        { "count",   required_argument, NULL, 'c' },
+        { "follow",  no_argument,       NULL, 'f' },
+        { "verbose", optional_argument, NULL, 'v' },
+        { "version", no_argument,       NULL, 'V' },
+        { "help",    no_argument,       NULL, 'h' },
+        { 0, 0, 0, 0 }
+    };
+
+    while ((opt = getopt_long (argc, argv, "c:fv::Vh", options, NULL)) != EOF) {
+        switch (opt) {
+        case 'c':
+            count = atol (optarg);
+            if (count < 0) {
+                fprintf (stderr, "[error]: invalid count '%s'\n", optarg);
+                exit (1);
+            }
+            break;
+        case 'f':
+            follow = 1;
+            break;
+        case 'v':
+            verbose = (optarg != NULL) ? atoi (optarg) : verbose + 1;
+            break;
+        case 'V':
+            print_version (argv[0]);
+            exit (0);
+        case 'h':
+            print_usage (argv[0]);
+            exit (0);
+        default:
+            print_usage (argv[0]);
+            exit (1);
+        }
+    }
+
+    if (optind != argc - 1) {
+        print_usage (argv[0]);
+        exit (1);
+    }
+
+    if (read_journal (&journal, argv[optind]) != 0) {
+        fprintf (stderr, "[error]: failed to read journal '%s' (%s)\n",
+                 argv[optind], strerror (errno));
+        exit (1);
+    }
+
+    head = __atomic_load_n (&journal.head->head, __ATOMIC_ACQUIRE);
+
+    next = 0;
+    if ((count >= 0) && (head > (uint64_t) count)) {
+        next = head - count;
+    }
+
+    delay.tv_sec = 0;
+    delay.tv_nsec = FENCE_KDUMP_FOLLOW_INTERVAL * 1000000L;
+
+    do {
+        next = dump_journal (&journal, next);
+    } while ((follow != 0) && (nanosleep (&delay, NULL) == 0));
+
+    close_journal (&journal);
+
+    return (0);
+}
@@ -32,9 +32,20 @@
 #include <netdb.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
 
 #include "options.h"
 #include "message.h"
+#include "peers.h"
+#include "schedule.h"
 #include "version.h"
 
 static int verbose = 0;
@@ -51,21 +62,229 @@ do {                                               \
         fprintf (stderr, "[error]: " fmt, ##args); \
 } while (0);
 
+/*
+ * One round of messages: an mmsghdr per node, grouped by the socket
+ * of the node's family, all pointing at the same message buffer.
+ */
+typedef struct fence_kdump_batch {
+    int count;
+    struct iovec iov;
+#ifdef FENCE_KDUMP_STATIC
+    struct mmsghdr hdr[FENCE_KDUMP_STATIC_NODES];
+    fence_kdump_node_t *node[FENCE_KDUMP_STATIC_NODES];
+#else
+    struct mmsghdr *hdr;
+    fence_kdump_node_t **node;
+#endif
+} fence_kdump_batch_t;
+
+static int
+init_batch (fence_kdump_batch_t *batch, fence_kdump_opts_t *opts, void *msg, int len)
+{
+    int i;
+    fence_kdump_node_t *node;
+
+    batch->count = 0;
+    batch->iov.iov_base = msg;
+    batch->iov.iov_len = len;
+
+#ifdef FENCE_KDUMP_STATIC
+    memset (batch->hdr, 0, sizeof (batch->hdr));
+#else
+    batch->hdr = calloc (opts->nodes.count, sizeof (struct mmsghdr));
+    batch->node = calloc (opts->nodes.count, sizeof (fence_kdump_node_t *));
+
+    if (!batch->hdr || !batch->node) {
+        log_error (2, "calloc (%s)\n", strerror (errno));
+        return (1);
+    }
+#endif
+
+    for (i = 0; i < opts->nsockets; i++) {
+        for_each_node (node, &opts->nodes) {
+            if (node->socket != opts->sockets[i]) {
+                continue;
+            }
+            batch->hdr[batch->count].msg_hdr.msg_name = &node->sa;
+            batch->hdr[batch->count].msg_hdr.msg_namelen = node->sslen;
+            batch->hdr[batch->count].msg_hdr.msg_iov = &batch->iov;
+            batch->hdr[batch->count].msg_hdr.msg_iovlen = 1;
+            batch->node[batch->count] = node;
+            batch->count++;
+        }
+    }
+
+    return (0);
+}
+
+static void
+free_batch (fence_kdump_batch_t *batch)
+{
+#ifndef FENCE_KDUMP_STATIC
+    free (batch->hdr);
+    free (batch->node);
+#endif
+}
+
+/*
+ * Sends the round with one sendmmsg() per socket. sendmmsg() stops at
+ * the first destination that fails, so that one is reported and the
+ * rest of the round is sent with the next call.
+ */
+static int
+send_batch (fence_kdump_batch_t *batch)
+{
+    int i = 0;
+    int j;
+    int n;
+    int end;
+    int sent = 0;
+
+    while (i < batch->count) {
+        for (end = i + 1; end < batch->count; end++) {
+            if (batch->node[end]->socket != batch->node[i]->socket) {
+                break;
+            }
+        }
+
+        while (i < end) {
+            n = sendmmsg (batch->node[i]->socket, &batch->hdr[i], end - i, 0);
+            if (n < 0) {
+                log_error (2, "sendmmsg to node '%s' (%s)\n",
+                           batch->node[i]->info->addr, strerror (errno));
+                i++;
+                continue;
+            }
+            for (j = i; j < i + n; j++) {
+                log_debug (1, "message sent to node '%s'\n", batch->node[j]->info->addr);
+            }
+            sent += n;
+            i += n;
+        }
+    }
+
+    return (sent);
+}
+
 static int
-send_message (const fence_kdump_node_t *node, void *msg, int len)
+get_boot_id (uint8_t *boot_id)
 {
-    int error;
+    int n = 0;
+    int c;
+    int fd;
+    ssize_t len;
+    char buf[64];
+    char *p;
 
-    error = sendto (node->socket, msg, len, 0, node->info->ai_addr, node->info->ai_addrlen);
-    if (error < 0) {
-        log_error (2, "sendto (%s)\n", strerror (errno));
-        goto out;
+    memset (boot_id, 0, FENCE_KDUMP_BOOT_ID_LEN);
+
+    fd = open ("/proc/sys/kernel/random/boot_id", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        log_error (1, "open boot_id (%s)\n", strerror (errno));
+        return (1);
     }
 
-    log_debug (1, "message sent to node '%s'\n", node->addr);
+    len = read (fd, buf, sizeof (buf) - 1);
+    close (fd);
+
+    buf[(len > 0) ? len : 0] = 0;
 
-out:
-    return (error);
+    for (p = buf; (*p != 0) && (n < FENCE_KDUMP_BOOT_ID_LEN * 2); p++) {
+        if (!isxdigit (*p)) {
+            continue;
+        }
+        c = isdigit (*p) ? (*p - '0') : (tolower (*p) - 'a' + 10);
+        boot_id[n / 2] |= (uint8_t) ((n % 2) ? c : (c << 4));
+        n++;
+    }
+
+    return ((n == FENCE_KDUMP_BOOT_ID_LEN * 2) ? 0 : 1);
+}
+
+static void
+print_footprint (void)
+{
+    struct rusage usage;
+
+    if (getrusage (RUSAGE_SELF, &usage) == 0) {
+        log_debug (1, "peak rss %ld kB\n", usage.ru_maxrss);
+    }
+}
+
+static void
+parse_feed (fence_kdump_progress_t *progress, char *line)
+{
+    int stage;
+    char *save;
+    char *word;
+
+    word = strtok_r (line, " \t", &save);
+    if (word == NULL) {
+        return;
+    }
+
+    stage = parse_stage (word);
+    if (stage < 0) {
+        log_error (1, "unsupported stage '%s'\n", word);
+        return;
+    }
+
+    progress->stage = stage;
+
+    if ((word = strtok_r (NULL, " \t", &save)) != NULL) {
+        progress->written = strtoull (word, NULL, 10);
+    }
+    if ((word = strtok_r (NULL, " \t", &save)) != NULL) {
+        progress->total = strtoull (word, NULL, 10);
+    }
+
+    log_debug (1, "stage '%s' written %llu of %llu\n", stage_name (progress->stage),
+               (unsigned long long) progress->written,
+               (unsigned long long) progress->total);
+}
+
+/*
+ * Applies every complete line available on the non-blocking feed.
+ * Returns -1 once the feed reached end of file.
+ */
+static int
+read_feed (int fd, fence_kdump_progress_t *progress)
+{
+    ssize_t n;
+    char *line;
+    char *end;
+    static char buf[256];
+    static size_t len = 0;
+
+    for (;;) {
+        n = read (fd, buf + len, sizeof (buf) - 1 - len);
+        if (n == 0) {
+            return (-1);
+        }
+        if (n < 0) {
+            if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+                log_error (2, "read (%s)\n", strerror (errno));
+                return (-1);
+            }
+            return (0);
+        }
+
+        len += n;
+        buf[len] = 0;
+
+        for (line = buf; (end = strchr (line, '\n')) != NULL; line = end + 1) {
+            *end = 0;
+            parse_feed (progress, line);
+        }
+
+        len -= line - buf;
+        memmove (buf, line, len);
+
+        /* drop a line too long to ever complete */
+        if (len == sizeof (buf) - 1) {
+            len = 0;
+        }
+    }
 }
 
 static void
@@ -82,7 +301,33 @@ print_usage (const char *self)
     fprintf (stdout, "%s\n",
              "  -c, --count=COUNT            Number of messages to send (default: 0)");
     fprintf (stdout, "%s\n",
-             "  -i, --interval=INTERVAL      Interval in seconds (default: 10)");
+             "  -i, --interval=INTERVAL      Maximum interval in seconds (default: 10)");
+    fprintf (stdout, "%s\n",
+             "  -b, --burst=COUNT            Messages sent before backing off (default: 5)");
+    fprintf (stdout, "%s\n",
+             "  -B, --burst-interval=MSEC    Milliseconds between burst messages (default: 200)");
+    fprintf (stdout, "%s\n",
+             "  -k, --key-file=FILE          File containing the shared message key");
+    fprintf (stdout, "%s\n",
+             "  -I, --identity=NAME          Node name sent in messages (default: hostname)");
+    fprintf (stdout, "%s\n",
+             "  -s, --stage=STAGE            Dump stage: (boot, saving, done, failed)");
+    fprintf (stdout, "%s\n",
+             "  -P, --progress=BYTES[/TOTAL] Bytes of the dump written so far");
+    fprintf (stdout, "%s\n",
+             "  -F, --feed                   Read 'STAGE [BYTES [TOTAL]]' lines from stdin");
+    fprintf (stdout, "%s\n",
+             "  -m, --multicast=GROUP        Also send to a multicast group or broadcast address");
+    fprintf (stdout, "%s\n",
+             "  -T, --ttl=TTL                Multicast TTL or hop limit (default: 1)");
+    fprintf (stdout, "%s\n",
+             "  -e, --interface=IFACE        Interface used for multicast");
+    fprintf (stdout, "%s\n",
+             "  -r, --resolve-timeout=MSEC   Time allowed for name resolution (default: 2000)");
+    fprintf (stdout, "%s\n",
+             "  -C, --dns-cache=FILE         Cache of node addresses used when DNS is slow");
+    fprintf (stdout, "%s\n",
+             "  -N, --peer-file=FILE         Read nodes from FILE, again on SIGHUP or change");
     fprintf (stdout, "%s\n",
              "  -v, --verbose                Print verbose output");
     fprintf (stdout, "%s\n",
@@ -94,62 +339,593 @@ print_usage (const char *self)
     return;
 }
 
+/* Nodes of the same family share one socket. */
 static int
-get_options_node (fence_kdump_opts_t *opts)
+get_socket (fence_kdump_opts_t *opts, int family)
 {
-    int error;
-    struct addrinfo hints;
+    int i;
+    int sock;
+    int domain;
+    socklen_t len;
+
+    for (i = 0; i < opts->nsockets; i++) {
+        len = sizeof (domain);
+        if ((getsockopt (opts->sockets[i], SOL_SOCKET, SO_DOMAIN, &domain, &len) == 0) &&
+            (domain == family)) {
+            return (opts->sockets[i]);
+        }
+    }
+
+    if (opts->nsockets >= FENCE_KDUMP_MAX_SOCKETS) {
+        log_error (2, "too many sockets\n");
+        return (-1);
+    }
+
+    sock = socket (family, SOCK_DGRAM | SOCK_CLOEXEC, IPPROTO_UDP);
+    if (sock < 0) {
+        log_error (2, "socket (%s)\n", strerror (errno));
+        return (-1);
+    }
+
+    opts->sockets[opts->nsockets++] = sock;
+
+    return (sock);
+}
+
+/*
+ * Lists the nodes given on the command line, then those of the peer
+ * file, then the multicast group, each with the family and port it is
+ * to be sent to.
+ */
+static void
+add_options_peers (fence_kdump_opts_t *opts, fence_kdump_peer_t *peers, int *n,
+                   char **names, int count)
+{
+    int i;
+
+    for (i = 0; i < count; i++) {
+        peers[*n].name = names[i];
+        peers[*n].family = opts->family;
+        peers[*n].port = opts->ipport;
+        (*n)++;
+    }
+}
+
+static void
+add_options_group (fence_kdump_opts_t *opts, fence_kdump_peer_t *peers, int *n)
+{
+    if (opts->group != NULL) {
+        add_options_peers (opts, peers, n, &opts->group, 1);
+    }
+}
+
+static int
+read_options_peers (fence_kdump_opts_t *opts, fence_kdump_peer_t *peers, int *n, int max,
+                    char *buf, size_t len)
+{
+    int bad;
+    int count;
+
+    count = read_peer_file (opts->peerpath, buf, len, peers + *n, max - *n,
+                            opts->family, opts->ipport, &bad);
+    if (count < 0) {
+        log_error (1, "failed to read peer file '%s' (%s)\n", opts->peerpath, strerror (errno));
+        return (1);
+    }
+    if (bad > 0) {
+        log_error (1, "ignored %d invalid line(s) in '%s'\n", bad, opts->peerpath);
+    }
+
+    *n += count;
+
+    return (0);
+}
+
+#ifdef FENCE_KDUMP_STATIC
+
+static fence_kdump_resolve_t resolve_table[FENCE_KDUMP_STATIC_NODES];
+static fence_kdump_peer_t peer_table[FENCE_KDUMP_STATIC_NODES + 1];
+static char peer_buf[FENCE_KDUMP_PEER_FILE_LEN];
+
+/*
+ * Neither the resolver nor NSS is linked into the static build, so
+ * names are only found in the address cache.
+ */
+static fence_kdump_resolve_t *
+resolve_options_nodes (fence_kdump_opts_t *opts, const fence_kdump_peer_t *peers, int n,
+                       int *busy)
+{
+    int i;
+
+    *busy = 0;
+
+    if (n > FENCE_KDUMP_STATIC_NODES) {
+        log_error (1, "too many nodes\n");
+        return (NULL);
+    }
+
+    for (i = 0; i < n; i++) {
+        init_resolve (&resolve_table[i], peers[i].name, peers[i].family, peers[i].port);
+        if (add_resolve_numeric (&resolve_table[i], peers[i].name,
+                                 peers[i].family, peers[i].port) == 0) {
+            resolve_table[i].source = FENCE_KDUMP_RESOLVE_NUMERIC;
+        }
+    }
+
+    read_resolve_cache (resolve_table, n, opts->cachepath);
+
+    return (resolve_table);
+}
+
+static void
+free_resolve (fence_kdump_resolve_t *res)
+{
+    (void) res;
+}
+
+/* The static build reads the peer file into fixed buffers. */
+static fence_kdump_peer_t *
+get_options_peers (fence_kdump_opts_t *opts, char **names, int count, int *n)
+{
+    int max = FENCE_KDUMP_STATIC_NODES + 1;
+
+    *n = 0;
+
+    if (count > FENCE_KDUMP_STATIC_NODES) {
+        log_error (1, "too many nodes\n");
+        return (NULL);
+    }
+
+    add_options_peers (opts, peer_table, n, names, count);
+
+    if ((opts->peerpath != NULL) &&
+        (read_options_peers (opts, peer_table, n, max - (opts->group != NULL),
+                             peer_buf, sizeof (peer_buf)) != 0)) {
+        return (NULL);
+    }
+
+    add_options_group (opts, peer_table, n);
+
+    return (peer_table);
+}
+
+static void
+free_peers (fence_kdump_peer_t *peers)
+{
+    (void) peers;
+}
+
+#else
+
+/*
+ * Look up all nodes at once, bounded by the resolve timeout, so a slow
+ * DNS server cannot hold back the first message. Names the resolver
+ * did not answer for in time are taken from the address cache.
+ */
+static fence_kdump_resolve_t *
+resolve_options_nodes (fence_kdump_opts_t *opts, const fence_kdump_peer_t *peers, int n,
+                       int *busy)
+{
+    int i;
+    fence_kdump_resolve_t *res;
+
+    *busy = 0;
+
+    res = calloc (n, sizeof (fence_kdump_resolve_t));
+    if (!res) {
+        log_error (2, "calloc (%s)\n", strerror (errno));
+        return (NULL);
+    }
+
+    for (i = 0; i < n; i++) {
+        init_resolve (&res[i], peers[i].name, peers[i].family, peers[i].port);
+    }
+
+    *busy = resolve_names (res, n, opts->resolve_timeout);
+
+    read_resolve_cache (res, n, opts->cachepath);
+
+    if (write_resolve_cache (res, n, opts->cachepath) != 0) {
+        log_debug (1, "failed to update cache '%s' (%s)\n",
+                   opts->cachepath, strerror (errno));
+    }
+
+    return (res);
+}
+
+static void
+free_resolve (fence_kdump_resolve_t *res)
+{
+    free (res);
+}
+
+/*
+ * The peers and the text of the peer file they point into are kept
+ * in one block.
+ */
+static fence_kdump_peer_t *
+get_options_peers (fence_kdump_opts_t *opts, char **names, int count, int *n)
+{
+    int max;
+    size_t len = 1;
+    struct stat st;
+    fence_kdump_peer_t *peers;
+
+    *n = 0;
+
+    if (opts->peerpath != NULL) {
+        if (stat (opts->peerpath, &st) != 0) {
+            log_error (1, "failed to read peer file '%s' (%s)\n",
+                       opts->peerpath, strerror (errno));
+            return (NULL);
+        }
+        len = st.st_size + 1;
+    }
+
+    max = count + len / 2 + 2;
+
+    peers = calloc (1, max * sizeof (fence_kdump_peer_t) + len);
+    if (!peers) {
+        log_error (2, "calloc (%s)\n", strerror (errno));
+        return (NULL);
+    }
+
+    add_options_peers (opts, peers, n, names, count);
+
+    if ((opts->peerpath != NULL) &&
+        (read_options_peers (opts, peers, n, max - 1, (char *) (peers + max), len) != 0)) {
+        free (peers);
+        return (NULL);
+    }
+
+    add_options_group (opts, peers, n);
+
+    return (peers);
+}
+
+static void
+free_peers (fence_kdump_peer_t *peers)
+{
+    free (peers);
+}
+
+#endif
+
+/* Only the first address of a node is sent to. */
+static int
+get_options_node (fence_kdump_opts_t *opts, const fence_kdump_resolve_t *res)
+{
+    int sock;
     fence_kdump_node_t *node;
+    fence_kdump_addr_t key;
+    socklen_t len;
 
-    node = malloc (sizeof (fence_kdump_node_t));
-    if (!node) {
-        log_error (2, "malloc (%s)\n", strerror (errno));
+    if (res->source == FENCE_KDUMP_RESOLVE_NONE) {
         return (1);
     }
 
-    memset (node, 0, sizeof (fence_kdump_node_t));
-    memset (&hints, 0, sizeof (hints));
+    if (res->source == FENCE_KDUMP_RESOLVE_CACHE) {
+        log_debug (1, "using cached address of node '%s'\n", res->name);
+    }
 
-    hints.ai_family = opts->family;
-    hints.ai_socktype = SOCK_DGRAM;
-    hints.ai_protocol = IPPROTO_UDP;
-    hints.ai_flags = AI_NUMERICSERV;
+    len = get_addrlen (&res->addr[0]);
+    if (len > sizeof (node->sa)) {
+        return (1);
+    }
 
-    strncpy (node->name, opts->nodename, sizeof (node->name));
-    snprintf (node->port, sizeof (node->port), "%d", opts->ipport);
+    sock = get_socket (opts, res->addr[0].ss_family);
+    if (sock < 0) {
+        return (1);
+    }
 
-    node->info = NULL;
-    error = getaddrinfo (node->name, node->port, &hints, &node->info);
-    if (error != 0) {
-        log_error (2, "getaddrinfo (%s)\n", gai_strerror (error));
-        free_node (node);
+    node = add_node (&opts->nodes);
+    if (node == NULL) {
+        log_error (2, "too many nodes\n");
         return (1);
     }
 
-    error = getnameinfo (node->info->ai_addr, node->info->ai_addrlen,
-                         node->addr, sizeof (node->addr),
-                         node->port, sizeof (node->port),
-                         NI_NUMERICHOST | NI_NUMERICSERV);
-    if (error != 0) {
-        log_error (2, "getnameinfo (%s)\n", gai_strerror (error));
-        free_node (node);
+    strncpy (node->info->name, res->name, sizeof (node->info->name) - 1);
+    snprintf (node->info->port, sizeof (node->info->port), "%d", res->port);
+    node->info->family = res->family;
+
+    node->socket = sock;
+    memcpy (&node->sa, &res->addr[0], len);
+    node->sslen = len;
+
+    set_addr (&key, &node->sa.sa);
+    print_addr (&key, node->info->addr, sizeof (node->info->addr));
+
+    return (0);
+}
+
+static fence_kdump_node_t *
+find_node (const fence_kdump_nodes_t *nodes, const fence_kdump_peer_t *peer)
+{
+    fence_kdump_node_t *node;
+    char port[FENCE_KDUMP_PORT_LEN];
+
+    snprintf (port, sizeof (port), "%d", peer->port);
+
+    for_each_node (node, nodes) {
+        if ((node->info->family == peer->family) &&
+            (strcmp (node->info->port, port) == 0) &&
+            (strcasecmp (node->info->name, peer->name) == 0)) {
+            return (node);
+        }
+    }
+
+    return (NULL);
+}
+
+/* Takes over a node of the previous table, address and socket included. */
+static int
+copy_node (fence_kdump_nodes_t *nodes, const fence_kdump_node_t *prev)
+{
+    fence_kdump_node_t *node;
+    fence_kdump_node_info_t *info;
+
+    node = add_node (nodes);
+    if (node == NULL) {
         return (1);
     }
 
-    node->socket = socket (node->info->ai_family,
-                           node->info->ai_socktype,
-                           node->info->ai_protocol);
-    if (node->socket < 0) {
-        log_error (2, "socket (%s)\n", strerror (errno));
-        free_node (node);
+    info = node->info;
+    *node = *prev;
+    *info = *prev->info;
+    node->info = info;
+
+    return (0);
+}
+
+/*
+ * Builds a new node table. A node that is in the current table with
+ * the same port and family is taken over as it is, so only names that
+ * are new get resolved. The current table is kept if no node at all
+ * could be added. Returns the number of nodes that could not be added,
+ * or -1 if the table was kept.
+ */
+static int
+get_options_nodes (fence_kdump_opts_t *opts, char **names, int count)
+{
+    int i;
+    int n;
+    int m = 0;
+    int busy = 0;
+    int reused = 0;
+    int failed = 0;
+    fence_kdump_node_t *prev;
+    fence_kdump_nodes_t old = opts->nodes;
+    fence_kdump_peer_t *peers;
+    fence_kdump_resolve_t *res = NULL;
+
+    peers = get_options_peers (opts, names, count, &n);
+    if (peers == NULL) {
+        return (-1);
+    }
+
+    init_nodes (&opts->nodes);
+
+    if ((n == 0) || (alloc_nodes (&opts->nodes, n) != 0)) {
+        if (n > 0) {
+            log_error (1, "too many nodes\n");
+        }
+        opts->nodes = old;
+        free_peers (peers);
+        return (-1);
+    }
+
+    /* the peers left to resolve are moved to the front */
+    for (i = 0; i < n; i++) {
+        if (find_node (&opts->nodes, &peers[i]) != NULL) {
+            continue;
+        }
+        prev = find_node (&old, &peers[i]);
+        if (prev == NULL) {
+            peers[m++] = peers[i];
+        } else if (copy_node (&opts->nodes, prev) == 0) {
+            reused++;
+        }
+    }
+
+    if (m > 0) {
+        res = resolve_options_nodes (opts, peers, m, &busy);
+        for (i = 0; i < m; i++) {
+            if ((res == NULL) || (get_options_node (opts, &res[i]) != 0)) {
+                log_error (1, "failed to get node '%s'\n", peers[i].name);
+                failed++;
+            }
+        }
+    }
+
+    if (reused > 0) {
+        log_debug (1, "kept %d node(s) as they were\n", reused);
+    }
+
+    /* a lookup that could not be cancelled may still write to these */
+    if (busy == 0) {
+        free_resolve (res);
+        free_peers (peers);
+    }
+
+    if ((opts->nodes.count == 0) && (old.count > 0)) {
+        free_nodes (&opts->nodes);
+        opts->nodes = old;
+        return (-1);
+    }
+
+    free_nodes (&old);
+
+    return (failed);
+}
+
+/*
+ * The group is sent to like any other node, only its socket needs the
+ * multicast TTL and interface, or permission to broadcast.
+ */
+static int
+get_options_group (fence_kdump_opts_t *opts)
+{
+    unsigned int ifindex;
+    fence_kdump_addr_t group;
+    fence_kdump_peer_t peer;
+    fence_kdump_node_t *node;
+
+    peer.name = opts->group;
+    peer.family = opts->family;
+    peer.port = opts->ipport;
+
+    node = find_node (&opts->nodes, &peer);
+    if (node == NULL) {
+        return (1);
+    }
+
+    if (get_ifindex (opts->interface, &ifindex) != 0) {
+        log_error (1, "unknown interface '%s'\n", opts->interface);
         return (1);
     }
 
-    list_add_tail (&node->list, &opts->nodes);
+    set_addr (&group, &node->sa.sa);
+
+    if (set_multicast_send (node->socket, &group, opts->ttl, ifindex) != 0) {
+        log_error (1, "setsockopt (%s)\n", strerror (errno));
+        return (1);
+    }
+
+    return (0);
+}
+
+/*
+ * The peer file is read again on SIGHUP, and whenever a file of its
+ * name is written or moved into its directory. The directory is
+ * watched rather than the file, since editors and configuration tools
+ * usually replace the file instead of writing to it.
+ */
+typedef struct fence_kdump_reload {
+    struct pollfd fds[2];
+    int nfds;
+    const char *name;
+} fence_kdump_reload_t;
+
+static void
+init_reload_fds (fence_kdump_reload_t *reload)
+{
+    reload->nfds = 0;
+    reload->name = NULL;
+}
+
+static void
+free_reload (fence_kdump_reload_t *reload)
+{
+    while (reload->nfds > 0) {
+        close (reload->fds[--reload->nfds].fd);
+    }
+}
+
+static int
+add_reload_fd (fence_kdump_reload_t *reload, int fd)
+{
+    if (fd < 0) {
+        return (-1);
+    }
+
+    reload->fds[reload->nfds].fd = fd;
+    reload->fds[reload->nfds].events = POLLIN;
+    reload->nfds++;
 
     return (0);
 }
 
+static int
+init_reload (fence_kdump_reload_t *reload, const fence_kdump_opts_t *opts)
+{
+    int fd;
+    sigset_t mask;
+    char dir[PATH_MAX];
+    const char *slash;
+
+    sigemptyset (&mask);
+    sigaddset (&mask, SIGHUP);
+    sigprocmask (SIG_BLOCK, &mask, NULL);
+
+    if (add_reload_fd (reload, signalfd (-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC)) != 0) {
+        return (-1);
+    }
+
+    slash = strrchr (opts->peerpath, '/');
+    if (slash == NULL) {
+        strcpy (dir, ".");
+        reload->name = opts->peerpath;
+    } else {
+        snprintf (dir, sizeof (dir), "%.*s", (int) (slash - opts->peerpath) + 1, opts->peerpath);
+        reload->name = slash + 1;
+    }
+
+    fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+    if ((fd >= 0) && (inotify_add_watch (fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0)) {
+        close (fd);
+        return (-1);
+    }
+
+    return (add_reload_fd (reload, fd));
+}
+
+/* Drains the descriptors. Returns 1 if the peer file is to be read. */
+static int
+check_reload (fence_kdump_reload_t *reload)
+{
+    int i;
+    int changed = 0;
+    ssize_t n;
+    char *p;
+    const struct inotify_event *event;
+    char buf[4096] __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+
+    for (i = 0; i < reload->nfds; i++) {
+        if ((reload->fds[i].revents & POLLIN) == 0) {
+            continue;
+        }
+        while ((n = read (reload->fds[i].fd, buf, sizeof (buf))) > 0) {
+            if (i == 0) {
+                log_debug (1, "reload on signal\n");
+                changed = 1;
+                continue;
+            }
+            for (p = buf; p < buf + n; p += sizeof (*event) + event->len) {
+                event = (const struct inotify_event *) p;
+                if ((event->len > 0) && (strcmp (event->name, reload->name) == 0)) {
+                    log_debug (1, "reload on change of '%s'\n", reload->name);
+                    changed = 1;
+                }
+            }
+        }
+    }
+
+    return (changed);
+}
+
+static void
+reload_nodes (fence_kdump_opts_t *opts, char **names, int count, fence_kdump_batch_t *batch)
+{
+    int failed;
+
+    failed = get_options_nodes (opts, names, count);
+    if (failed < 0) {
+        log_error (1, "keeping the previous nodes\n");
+        return;
+    }
+
+    if ((opts->group != NULL) && (get_options_group (opts) != 0)) {
+        log_error (1, "failed to get multicast group '%s'\n", opts->group);
+    }
+
+    free_batch (batch);
+    if (init_batch (batch, opts, batch->iov.iov_base, batch->iov.iov_len) != 0) {
+        exit (1);
+    }
+
+    log_debug (1, "sending to %d node(s)\n", opts->nodes.count);
+}
+
 static void
 get_options (int argc, char **argv, fence_kdump_opts_t *opts)
 {
@@ -160,13 +936,26 @@ get_options (int argc, char **argv, fence_kdump_opts_t *opts)
         { "family",   required_argument, NULL, 'f' },
         { "count",    required_argument, NULL, 'c' },
         { "interval", required_argument, NULL, 'i' },
+        { "burst",    required_argument, NULL, 'b' },
+        { "burst-interval", required_argument, NULL, 'B' },
+        { "key-file", required_argument, NULL, 'k' },
+        { "identity", required_argument, NULL, 'I' },
+        { "stage",    required_argument, NULL, 's' },
+        { "progress", required_argument, NULL, 'P' },
+        { "feed",     optional_argument, NULL, 'F' },
+        { "multicast", required_argument, NULL, 'm' },
+        { "ttl",      required_argument, NULL, 'T' },
+        { "interface", required_argument, NULL, 'e' },
+        { "resolve-timeout", required_argument, NULL, 'r' },
+        { "dns-cache", required_argument, NULL, 'C' },
+        { "peer-file", required_argument, NULL, 'N' },
         { "verbose",  optional_argument, NULL, 'v' },
         { "version",  no_argument,       NULL, 'V' },
         { "help",     no_argument,       NULL, 'h' },
         { 0, 0, 0, 0 }
     };
 
-    while ((opt = getopt_long (argc, argv, "p:f:c:i:v::Vh", options, NULL)) != EOF) {
+    while ((opt = getopt_long (argc, argv, "p:f:c:i:b:B:k:I:s:P:F::m:T:e:r:C:N:v::Vh", options, NULL)) != EOF) {
         switch (opt) {
         case 'p':
             set_option_ipport (opts, optarg);
@@ -180,6 +969,45 @@ get_options (int argc, char **argv, fence_kdump_opts_t *opts)
         case 'i':
             set_option_interval (opts, optarg);
             break;
+        case 'b':
+            set_option_burst (opts, optarg);
+            break;
+        case 'B':
+            set_option_burst_interval (opts, optarg);
+            break;
+        case 'k':
+            set_option_keyfile (opts, optarg);
+            break;
+        case 'I':
+            set_option_identity (opts, optarg);
+            break;
+        case 's':
+            set_option_stage (opts, optarg);
+            break;
+        case 'P':
+            set_option_progress (opts, optarg);
+            break;
+        case 'F':
+            set_option_feed (opts, optarg);
+            break;
+        case 'm':
+            set_option_multicast (opts, optarg);
+            break;
+        case 'T':
+            set_option_ttl (opts, optarg);
+            break;
+        case 'e':
+            set_option_interface (opts, optarg);
+            break;
+        case 'r':
+            set_option_resolve_timeout (opts, optarg);
+            break;
+        case 'C':
+            set_option_cache (opts, optarg);
+            break;
+        case 'N':
+            set_option_peers (opts, optarg);
+            break;
         case 'v':
             set_option_verbose (opts, optarg);
             break;
@@ -204,11 +1032,23 @@ int
 main (int argc, char **argv)
 {
     int count = 1;
-    fence_kdump_msg_t msg;
+    int len;
+    long delay;
+    uint64_t seq;
+    unsigned int seed;
+    fence_kdump_schedule_t sched;
+    void *msg;
+    fence_kdump_msg_t msg_v1;
+    fence_kdump_msg_v2_t msg_v2;
     fence_kdump_opts_t opts;
-    fence_kdump_node_t *node;
+    fence_kdump_batch_t batch;
+    fence_kdump_reload_t reload;
+    struct timespec now;
+    uint8_t boot_id[FENCE_KDUMP_BOOT_ID_LEN];
+    char hostname[FENCE_KDUMP_NAME_LEN];
 
     init_options (&opts);
+    init_reload_fds (&reload);
 
     if (argc > 1) {
         get_options (argc, argv, &opts);
@@ -217,37 +1057,111 @@ main (int argc, char **argv)
         exit (1);
     }
 
-    for (; optind < argc; optind++) {
-        opts.nodename = argv[optind];
-        if (get_options_node (&opts) != 0) {
-            log_error (1, "failed to get node '%s'\n", opts.nodename);
-        }
-        opts.nodename = NULL;
+    get_options_nodes (&opts, &argv[optind], argc - optind);
+
+    if ((opts.group != NULL) && (get_options_group (&opts) != 0)) {
+        log_error (1, "failed to get multicast group '%s'\n", opts.group);
     }
 
-    if (list_empty (&opts.nodes)) {
+    if ((optind == argc) && (opts.group == NULL) && (opts.peerpath == NULL)) {
         print_usage (argv[0]);
         exit (1);
     }
 
+    if (opts.nodes.count == 0) {
+        log_error (0, "no nodes to send to\n");
+        exit (1);
+    }
+
     if (verbose != 0) {
         print_options (&opts);
     }
 
-    init_message (&msg);
+    if (get_options_key (&opts) != 0) {
+        exit (1);
+    }
+
+    if (opts.feed != 0) {
+        fcntl (STDIN_FILENO, F_SETFL, fcntl (STDIN_FILENO, F_GETFL) | O_NONBLOCK);
+    }
+
+    if ((opts.report != 0) && (opts.progress.stage == FENCE_KDUMP_STAGE_NONE)) {
+        opts.progress.stage = FENCE_KDUMP_STAGE_BOOT;
+    }
+
+    if (get_boot_id (boot_id) != 0) {
+        log_error (1, "failed to read boot id\n");
+    }
+
+    if ((opts.keyed != 0) || (opts.report != 0)) {
+        if (opts.identity == NULL) {
+            memset (hostname, 0, sizeof (hostname));
+            gethostname (hostname, sizeof (hostname) - 1);
+            set_option_identity (&opts, hostname);
+        }
+        init_message_v2 (&msg_v2, opts.identity, boot_id);
+        msg = &msg_v2;
+        len = sizeof (msg_v2);
+    } else {
+        init_message (&msg_v1);
+        msg = &msg_v1;
+        len = sizeof (msg_v1);
+    }
+
+    if (init_batch (&batch, &opts, msg, len) != 0) {
+        exit (1);
+    }
+
+    if ((opts.peerpath != NULL) && (init_reload (&reload, &opts) != 0)) {
+        log_error (1, "failed to watch peer file '%s' (%s)\n", opts.peerpath, strerror (errno));
+    }
+
+    /* the boot id is random per boot, so nodes that crashed
+     * together still pick different jitter */
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    memcpy (&seed, boot_id, sizeof (seed));
+    seed ^= (unsigned int) now.tv_nsec ^ (unsigned int) getpid ();
+
+    init_schedule (&sched, opts.burst, opts.burst_interval,
+                   opts.interval * 1000L, seed);
+
+    /* the agent keeps the last sequence number per boot id, so one
+     * restarted within the same kdump kernel must start above it */
+    clock_gettime (CLOCK_BOOTTIME, &now);
+    seq = (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
 
     for (;;) {
-        list_for_each_entry (node, &opts.nodes, list) {
-            send_message (node, &msg, sizeof (msg));
+        if ((opts.feed != 0) && (read_feed (STDIN_FILENO, &opts.progress) != 0)) {
+            opts.feed = 0;
         }
 
+        if (msg == &msg_v2) {
+            clock_gettime (CLOCK_REALTIME, &now);
+            sign_message_v2 (&msg_v2, &opts.hmac, ++seq,
+                             (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec,
+                             &opts.progress);
+        }
+
+        send_batch (&batch);
+
         if ((opts.count != 0) && (++count > opts.count)) {
             break;
         }
 
-        sleep (opts.interval);
+        delay = next_schedule (&sched);
+        log_debug (2, "next message in %ld ms\n", delay);
+
+        while (wait_schedule (&sched, reload.fds, reload.nfds) > 0) {
+            if (check_reload (&reload) != 0) {
+                reload_nodes (&opts, &argv[optind], argc - optind, &batch);
+            }
+        }
     }
 
+    print_footprint ();
+
+    free_reload (&reload);
+    free_batch (&batch);
     free_options (&opts);
 
     return (0);
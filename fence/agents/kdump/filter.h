@@ -0,0 +1,190 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*-
+ *
+ * Copyright (c) Ryan O'Hara (rohara@redhat.com)
+ * Copyright (c) Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef _FENCE_KDUMP_FILTER_H
+#define _FENCE_KDUMP_FILTER_H
+
+#include <stdint.h>
+#include <sys/socket.h>
+#include <linux/filter.h>
+
+#include "addr.h"
+#include "message.h"
+
+/*
+ * Classic BPF filter for the listening sockets. A UDP socket filter
+ * sees the packet from the UDP header on, and the IP header through
+ * SKF_NET_OFF. Packets of the wrong size, with the wrong magic or from
+ * an address that is not being waited for are dropped in the kernel,
+ * so they never wake the agent. Everything that passes is still fully
+ * checked in userspace.
+ */
+
+#define FENCE_KDUMP_UDP_HLEN 8
+
+/* conditional jumps only reach 255 instructions ahead */
+#define FENCE_KDUMP_FILTER_MAX_JUMP 255
+
+#define FENCE_KDUMP_FILTER_ACCEPT 0xFFFFFFFF
+#define FENCE_KDUMP_FILTER_REJECT 0
+
+typedef struct fence_kdump_filter {
+    struct sock_filter insn[BPF_MAXINSNS];
+    unsigned int len;
+} fence_kdump_filter_t;
+
+static inline void
+add_filter (fence_kdump_filter_t *filter, uint16_t code,
+            uint8_t jt, uint8_t jf, uint32_t k)
+{
+    struct sock_filter *insn = &filter->insn[filter->len++];
+
+    insn->code = code;
+    insn->jt = jt;
+    insn->jf = jf;
+    insn->k = k;
+}
+
+/* the filter loads words in network byte order */
+static inline uint32_t
+get_filter_word (const uint8_t *bytes)
+{
+    return (((uint32_t) bytes[0] << 24) | ((uint32_t) bytes[1] << 16) |
+            ((uint32_t) bytes[2] << 8) | (uint32_t) bytes[3]);
+}
+
+/*
+ * Accepts only messages of either version's size that start with the
+ * magic. The magic is in host byte order on the wire.
+ */
+static inline void
+init_filter (fence_kdump_filter_t *filter, int allow_v1)
+{
+    filter->len = 0;
+
+    add_filter (filter, BPF_LD | BPF_W | BPF_LEN, 0, 0, 0);
+    add_filter (filter, BPF_JMP | BPF_JEQ | BPF_K, 2, 0,
+                FENCE_KDUMP_UDP_HLEN + sizeof (fence_kdump_msg_v2_t));
+    add_filter (filter, BPF_JMP | BPF_JEQ | BPF_K, (allow_v1 != 0) ? 1 : 0, 0,
+                FENCE_KDUMP_UDP_HLEN + sizeof (fence_kdump_msg_t));
+    add_filter (filter, BPF_RET | BPF_K, 0, 0, FENCE_KDUMP_FILTER_REJECT);
+
+    add_filter (filter, BPF_LD | BPF_W | BPF_ABS, 0, 0, FENCE_KDUMP_UDP_HLEN);
+    add_filter (filter, BPF_JMP | BPF_JEQ | BPF_K, 1, 0, ntohl (FENCE_KDUMP_MAGIC));
+    add_filter (filter, BPF_RET | BPF_K, 0, 0, FENCE_KDUMP_FILTER_REJECT);
+}
+
+/*
+ * Appends the source address check. The IP version is read from the
+ * packet, since a dual-stack IPv6 socket also receives IPv4 packets.
+ * Returns -1 (and leaves the filter unchanged) if the set is too large
+ * to be checked within the limits of classic BPF.
+ */
+static inline int
+add_filter_addrs (fence_kdump_filter_t *filter, const fence_kdump_addrset_t *set)
+{
+    unsigned int i;
+    unsigned int j;
+    unsigned int n4 = 0;
+    unsigned int n6 = 0;
+    const fence_kdump_addr_t *addr;
+
+    for (i = 0; i < set->size; i++) {
+        if (set->entry[i].data == NULL) {
+            continue;
+        }
+        if (is_addr_v4mapped (&set->entry[i].addr)) {
+            n4++;
+        } else {
+            n6++;
+        }
+    }
+
+    if ((2 * n4 + 2 > FENCE_KDUMP_FILTER_MAX_JUMP) ||
+        (filter->len + 3 + (2 * n4 + 2) + (9 * n6 + 1) + 1 > BPF_MAXINSNS)) {
+        return (-1);
+    }
+
+    add_filter (filter, BPF_LD | BPF_B | BPF_ABS, 0, 0, SKF_NET_OFF);
+    add_filter (filter, BPF_ALU | BPF_RSH | BPF_K, 0, 0, 4);
+    add_filter (filter, BPF_JMP | BPF_JEQ | BPF_K, 0, 2 * n4 + 2, 4);
+
+    add_filter (filter, BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_NET_OFF + 12);
+    for (i = 0; i < set->size; i++) {
+        addr = &set->entry[i].addr;
+        if ((set->entry[i].data != NULL) && is_addr_v4mapped (addr)) {
+            add_filter (filter, BPF_JMP | BPF_JEQ | BPF_K, 0, 1,
+                        get_filter_word (&addr->bytes[12]));
+            add_filter (filter, BPF_RET | BPF_K, 0, 0, FENCE_KDUMP_FILTER_ACCEPT);
+        }
+    }
+    add_filter (filter, BPF_RET | BPF_K, 0, 0, FENCE_KDUMP_FILTER_REJECT);
+
+    /* each IPv6 address is four words, a mismatch skips to the next */
+    for (i = 0; i < set->size; i++) {
+        addr = &set->entry[i].addr;
+        if ((set->entry[i].data == NULL) || is_addr_v4mapped (addr)) {
+            continue;
+        }
+        for (j = 0; j < 4; j++) {
+            add_filter (filter, BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_NET_OFF + 8 + 4 * j);
+            add_filter (filter, BPF_JMP | BPF_JEQ | BPF_K, 0, 7 - 2 * j,
+                        get_filter_word (&addr->bytes[4 * j]));
+        }
+        add_filter (filter, BPF_RET | BPF_K, 0, 0, FENCE_KDUMP_FILTER_ACCEPT);
+    }
+    add_filter (filter, BPF_RET | BPF_K, 0, 0, FENCE_KDUMP_FILTER_REJECT);
+
+    return (0);
+}
+
+/*
+ * Builds the whole program. Without a set, or with one too large to
+ * check, only the size and magic are checked. Returns 1 if the source
+ * address is checked as well.
+ */
+static inline int
+build_filter (fence_kdump_filter_t *filter, int allow_v1,
+              const fence_kdump_addrset_t *set)
+{
+    init_filter (filter, allow_v1);
+
+    if ((set != NULL) && (set->count > 0) && (add_filter_addrs (filter, set) == 0)) {
+        return (1);
+    }
+
+    add_filter (filter, BPF_RET | BPF_K, 0, 0, FENCE_KDUMP_FILTER_ACCEPT);
+
+    return (0);
+}
+
+static inline int
+attach_filter (int sock, const fence_kdump_filter_t *filter)
+{
+    struct sock_fprog prog;
+
+    prog.len = filter->len;
+    prog.filter = (struct sock_filter *) filter->insn;
+
+    return (setsockopt (sock, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof (prog)));
+}
+
+#endif /* _FENCE_KDUMP_FILTER_H */
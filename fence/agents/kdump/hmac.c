@@ -0,0 +1,250 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*-
+ *
+ * Copyright (c) Ryan O'Hara (rohara@redhat.com)
+ * Copyright (c) Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "hmac.h"
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ROR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void
+sha256_transform (sha256_ctx_t *ctx, const uint8_t *block)
+{
+    int i;
+    uint32_t a, b, c, d, e, f, g, h;
+    uint32_t s0, s1, t1, t2;
+    uint32_t w[64];
+
+    for (i = 0; i < 16; i++) {
+        w[i] = ((uint32_t) block[i * 4] << 24) |
+               ((uint32_t) block[i * 4 + 1] << 16) |
+               ((uint32_t) block[i * 4 + 2] << 8) |
+               ((uint32_t) block[i * 4 + 3]);
+    }
+
+    for (i = 16; i < 64; i++) {
+        s0 = ROR (w[i - 15], 7) ^ ROR (w[i - 15], 18) ^ (w[i - 15] >> 3);
+        s1 = ROR (w[i - 2], 17) ^ ROR (w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    a = ctx->state[0];
+    b = ctx->state[1];
+    c = ctx->state[2];
+    d = ctx->state[3];
+    e = ctx->state[4];
+    f = ctx->state[5];
+    g = ctx->state[6];
+    h = ctx->state[7];
+
+    for (i = 0; i < 64; i++) {
+        s1 = ROR (e, 6) ^ ROR (e, 11) ^ ROR (e, 25);
+        t1 = h + s1 + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+        s0 = ROR (a, 2) ^ ROR (a, 13) ^ ROR (a, 22);
+        t2 = s0 + ((a & b) ^ (a & c) ^ (b & c));
+
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+
+    ctx->state[0] += a;
+    ctx->state[1] += b;
+    ctx->state[2] += c;
+    ctx->state[3] += d;
+    ctx->state[4] += e;
+    ctx->state[5] += f;
+    ctx->state[6] += g;
+    ctx->state[7] += h;
+}
+
+void
+sha256_init (sha256_ctx_t *ctx)
+{
+    ctx->state[0] = 0x6a09e667;
+    ctx->state[1] = 0xbb67ae85;
+    ctx->state[2] = 0x3c6ef372;
+    ctx->state[3] = 0xa54ff53a;
+    ctx->state[4] = 0x510e527f;
+    ctx->state[5] = 0x9b05688c;
+    ctx->state[6] = 0x1f83d9ab;
+    ctx->state[7] = 0x5be0cd19;
+    ctx->count = 0;
+}
+
+void
+sha256_update (sha256_ctx_t *ctx, const void *data, size_t len)
+{
+    size_t used;
+    size_t fill;
+    const uint8_t *p = data;
+
+    used = ctx->count % SHA256_BLOCK_LEN;
+    ctx->count += len;
+
+    if (used != 0) {
+        fill = SHA256_BLOCK_LEN - used;
+        if (len < fill) {
+            memcpy (&ctx->block[used], p, len);
+            return;
+        }
+        memcpy (&ctx->block[used], p, fill);
+        sha256_transform (ctx, ctx->block);
+        p += fill;
+        len -= fill;
+    }
+
+    while (len >= SHA256_BLOCK_LEN) {
+        sha256_transform (ctx, p);
+        p += SHA256_BLOCK_LEN;
+        len -= SHA256_BLOCK_LEN;
+    }
+
+    memcpy (ctx->block, p, len);
+}
+
+void
+sha256_final (sha256_ctx_t *ctx, uint8_t *digest)
+{
+    int i;
+    size_t used;
+    uint64_t bits = ctx->count * 8;
+
+    used = ctx->count % SHA256_BLOCK_LEN;
+    ctx->block[used++] = 0x80;
+
+    if (used > SHA256_BLOCK_LEN - 8) {
+        memset (&ctx->block[used], 0, SHA256_BLOCK_LEN - used);
+        sha256_transform (ctx, ctx->block);
+        used = 0;
+    }
+
+    memset (&ctx->block[used], 0, SHA256_BLOCK_LEN - 8 - used);
+
+    for (i = 0; i < 8; i++) {
+        ctx->block[SHA256_BLOCK_LEN - 1 - i] = (uint8_t) (bits >> (i * 8));
+    }
+
+    sha256_transform (ctx, ctx->block);
+
+    for (i = 0; i < 8; i++) {
+        digest[i * 4]     = (uint8_t) (ctx->state[i] >> 24);
+        digest[i * 4 + 1] = (uint8_t) (ctx->state[i] >> 16);
+        digest[i * 4 + 2] = (uint8_t) (ctx->state[i] >> 8);
+        digest[i * 4 + 3] = (uint8_t) (ctx->state[i]);
+    }
+}
+
+void
+hmac_init (hmac_ctx_t *ctx, const void *key, size_t keylen)
+{
+    int i;
+    uint8_t pad[SHA256_BLOCK_LEN];
+    uint8_t hash[SHA256_DIGEST_LEN];
+
+    memset (pad, 0, sizeof (pad));
+
+    if (keylen > SHA256_BLOCK_LEN) {
+        sha256_init (&ctx->inner);
+        sha256_update (&ctx->inner, key, keylen);
+        sha256_final (&ctx->inner, hash);
+        memcpy (pad, hash, sizeof (hash));
+    } else if (keylen > 0) {
+        memcpy (pad, key, keylen);
+    }
+
+    for (i = 0; i < SHA256_BLOCK_LEN; i++) {
+        pad[i] ^= 0x36;
+    }
+
+    sha256_init (&ctx->inner);
+    sha256_update (&ctx->inner, pad, sizeof (pad));
+
+    for (i = 0; i < SHA256_BLOCK_LEN; i++) {
+        pad[i] ^= 0x36 ^ 0x5c;
+    }
+
+    sha256_init (&ctx->outer);
+    sha256_update (&ctx->outer, pad, sizeof (pad));
+
+    memset (pad, 0, sizeof (pad));
+}
+
+void
+hmac_digest (const hmac_ctx_t *ctx, const void *data, size_t len,
+             uint8_t *digest, size_t digestlen)
+{
+    sha256_ctx_t sha;
+    uint8_t hash[SHA256_DIGEST_LEN];
+
+    sha = ctx->inner;
+    sha256_update (&sha, data, len);
+    sha256_final (&sha, hash);
+
+    sha = ctx->outer;
+    sha256_update (&sha, hash, sizeof (hash));
+    sha256_final (&sha, hash);
+
+    if (digestlen > sizeof (hash)) {
+        digestlen = sizeof (hash);
+    }
+
+    memcpy (digest, hash, digestlen);
+}
+
+int
+hmac_equal (const uint8_t *a, const uint8_t *b, size_t len)
+{
+    size_t i;
+    volatile uint8_t diff = 0;
+
+    for (i = 0; i < len; i++) {
+        diff |= a[i] ^ b[i];
+    }
+
+    return (diff == 0);
+}
@@ -0,0 +1,57 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*-
+ *
+ * Copyright (c) Ryan O'Hara (rohara@redhat.com)
+ * Copyright (c) Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef _FENCE_KDUMP_HMAC_H
+#define _FENCE_KDUMP_HMAC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_BLOCK_LEN  64
+#define SHA256_DIGEST_LEN 32
+
+typedef struct sha256_ctx {
+    uint32_t state[8];
+    uint64_t count;
+    uint8_t block[SHA256_BLOCK_LEN];
+} sha256_ctx_t;
+
+typedef struct hmac_ctx {
+    sha256_ctx_t inner;
+    sha256_ctx_t outer;
+} hmac_ctx_t;
+
+void sha256_init (sha256_ctx_t *ctx);
+void sha256_update (sha256_ctx_t *ctx, const void *data, size_t len);
+void sha256_final (sha256_ctx_t *ctx, uint8_t *digest);
+
+/*
+ * HMAC-SHA256. hmac_init() prepares a context from the key once; the
+ * context may then be copied and used for any number of messages.
+ */
+void hmac_init (hmac_ctx_t *ctx, const void *key, size_t keylen);
+void hmac_digest (const hmac_ctx_t *ctx, const void *data, size_t len,
+                  uint8_t *digest, size_t digestlen);
+
+/* Compares in time independent of where the buffers first differ. */
+int hmac_equal (const uint8_t *a, const uint8_t *b, size_t len);
+
+#endif /* _FENCE_KDUMP_HMAC_H */
@@ -0,0 +1,353 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*-
+ *
+ * Copyright (c) Ryan O'Hara (rohara@redhat.com)
+ * Copyright (c) Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef _FENCE_KDUMP_JOURNAL_H
+#define _FENCE_KDUMP_JOURNAL_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "addr.h"
+#include "message.h"
+
+#define FENCE_KDUMP_JOURNAL_MAGIC   0x4A4B4446
+#define FENCE_KDUMP_JOURNAL_VERSION 1
+#define FENCE_KDUMP_JOURNAL_SLOTS   4096
+
+/* why a packet was accepted or rejected */
+enum {
+    FENCE_KDUMP_VERDICT_ACCEPT   = 0,
+    FENCE_KDUMP_VERDICT_SIZE     = 1,
+    FENCE_KDUMP_VERDICT_MAGIC    = 2,
+    FENCE_KDUMP_VERDICT_VERSION  = 3,
+    FENCE_KDUMP_VERDICT_UNAUTH   = 4,
+    FENCE_KDUMP_VERDICT_UNKNOWN  = 5,
+    FENCE_KDUMP_VERDICT_IDENTITY = 6,
+    FENCE_KDUMP_VERDICT_DIGEST   = 7,
+    FENCE_KDUMP_VERDICT_STALE    = 8,
+    FENCE_KDUMP_VERDICT_REPLAY   = 9,
+};
+
+/*
+ * The journal file is this header followed by a ring of fixed-size
+ * entries. Head counts the entries ever written, so entry n lives in
+ * slot n % slots. Everything is in host byte order; the file is only
+ * meant to be read on the machine that wrote it.
+ */
+typedef struct fence_kdump_journal_head {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slots;
+    uint32_t size;
+    uint64_t head;
+    uint8_t pad[40];
+} fence_kdump_journal_head_t;
+
+/*
+ * One packet. The sequence number is 0 while the entry is written and
+ * is set to its 1-based position in the journal once it is complete,
+ * so a reader that sees the same non-zero sequence number before and
+ * after copying an entry knows the copy is consistent.
+ */
+typedef struct fence_kdump_journal_entry {
+    uint64_t seq;
+    uint64_t time;
+    fence_kdump_addr_t addr;
+    char node[FENCE_KDUMP_NODE_ID_LEN];
+    uint64_t msgseq;
+    uint32_t version;
+    uint16_t port;
+    uint8_t verdict;
+    uint8_t stage;
+    uint8_t pad[16];
+} fence_kdump_journal_entry_t;
+
+typedef struct fence_kdump_journal {
+    int fd;
+    size_t len;
+    fence_kdump_journal_head_t *head;
+    fence_kdump_journal_entry_t *entry;
+} fence_kdump_journal_t;
+
+static inline const char *
+verdict_name (uint8_t verdict)
+{
+    switch (verdict) {
+    case FENCE_KDUMP_VERDICT_ACCEPT:
+        return ("accept");
+    case FENCE_KDUMP_VERDICT_SIZE:
+        return ("size");
+    case FENCE_KDUMP_VERDICT_MAGIC:
+        return ("magic");
+    case FENCE_KDUMP_VERDICT_VERSION:
+        return ("version");
+    case FENCE_KDUMP_VERDICT_UNAUTH:
+        return ("unauthenticated");
+    case FENCE_KDUMP_VERDICT_UNKNOWN:
+        return ("unknown-sender");
+    case FENCE_KDUMP_VERDICT_IDENTITY:
+        return ("identity");
+    case FENCE_KDUMP_VERDICT_DIGEST:
+        return ("digest");
+    case FENCE_KDUMP_VERDICT_STALE:
+        return ("stale");
+    case FENCE_KDUMP_VERDICT_REPLAY:
+        return ("replay");
+    default:
+        return ("unknown");
+    }
+}
+
+static inline size_t
+journal_size (uint32_t slots)
+{
+    return (sizeof (fence_kdump_journal_head_t) +
+            (size_t) slots * sizeof (fence_kdump_journal_entry_t));
+}
+
+static inline void
+init_journal (fence_kdump_journal_t *journal)
+{
+    journal->fd = -1;
+    journal->len = 0;
+    journal->head = NULL;
+    journal->entry = NULL;
+}
+
+static inline void
+close_journal (fence_kdump_journal_t *journal)
+{
+    if (journal->head != NULL) {
+        munmap (journal->head, journal->len);
+    }
+
+    if (journal->fd >= 0) {
+        close (journal->fd);
+    }
+
+    init_journal (journal);
+}
+
+static inline int
+map_journal (fence_kdump_journal_t *journal, int prot)
+{
+    journal->head = mmap (NULL, journal->len, prot, MAP_SHARED, journal->fd, 0);
+    if (journal->head == MAP_FAILED) {
+        journal->head = NULL;
+        return (-1);
+    }
+
+    journal->entry = (fence_kdump_journal_entry_t *) (journal->head + 1);
+
+    return (0);
+}
+
+static inline int
+check_journal_head (const fence_kdump_journal_head_t *head)
+{
+    return ((head->magic == FENCE_KDUMP_JOURNAL_MAGIC) &&
+            (head->version == FENCE_KDUMP_JOURNAL_VERSION) &&
+            (head->size == sizeof (fence_kdump_journal_entry_t)) &&
+            (head->slots > 0));
+}
+
+/*
+ * Open the journal for writing. Entries are written without locks, so
+ * there must be a single writer: the file is locked for the lifetime
+ * of the process and a second writer fails with EWOULDBLOCK. A journal
+ * of another layout is started over, but a file that is not a journal
+ * at all is left alone and fails with EINVAL. The blocks are allocated
+ * up front, since running out of space while writing to the mapping
+ * would kill the agent with SIGBUS.
+ */
+static inline int
+open_journal (fence_kdump_journal_t *journal, const char *path)
+{
+    int error;
+    uint32_t magic;
+    struct stat st;
+
+    init_journal (journal);
+
+    journal->fd = open (path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (journal->fd < 0) {
+        return (-1);
+    }
+
+    if ((flock (journal->fd, LOCK_EX | LOCK_NB) != 0) ||
+        (fstat (journal->fd, &st) != 0)) {
+        goto fail;
+    }
+
+    journal->len = journal_size (FENCE_KDUMP_JOURNAL_SLOTS);
+
+    if ((st.st_size != 0) &&
+        ((pread (journal->fd, &magic, sizeof (magic), 0) != sizeof (magic)) ||
+         (magic != FENCE_KDUMP_JOURNAL_MAGIC))) {
+        errno = EINVAL;
+        goto fail;
+    }
+
+    if (((size_t) st.st_size > journal->len) && (ftruncate (journal->fd, journal->len) != 0)) {
+        goto fail;
+    }
+
+    /* also fills in the holes of a sparse journal */
+    error = posix_fallocate (journal->fd, 0, journal->len);
+    if (error != 0) {
+        errno = error;
+        goto fail;
+    }
+
+    if (map_journal (journal, PROT_READ | PROT_WRITE) != 0) {
+        goto fail;
+    }
+
+    if (!check_journal_head (journal->head) ||
+        (journal->head->slots != FENCE_KDUMP_JOURNAL_SLOTS)) {
+        memset (journal->head, 0, journal->len);
+        journal->head->magic = FENCE_KDUMP_JOURNAL_MAGIC;
+        journal->head->version = FENCE_KDUMP_JOURNAL_VERSION;
+        journal->head->slots = FENCE_KDUMP_JOURNAL_SLOTS;
+        journal->head->size = sizeof (fence_kdump_journal_entry_t);
+    }
+
+    return (0);
+
+fail:
+    close_journal (journal);
+    return (-1);
+}
+
+/* Open a journal read-only, the writer may keep appending meanwhile. */
+static inline int
+read_journal (fence_kdump_journal_t *journal, const char *path)
+{
+    struct stat st;
+
+    init_journal (journal);
+
+    journal->fd = open (path, O_RDONLY | O_CLOEXEC);
+    if (journal->fd < 0) {
+        return (-1);
+    }
+
+    if ((fstat (journal->fd, &st) != 0) ||
+        ((size_t) st.st_size < sizeof (fence_kdump_journal_head_t))) {
+        errno = EINVAL;
+        goto fail;
+    }
+
+    journal->len = st.st_size;
+
+    if (map_journal (journal, PROT_READ) != 0) {
+        goto fail;
+    }
+
+    if (!check_journal_head (journal->head) ||
+        (journal_size (journal->head->slots) != journal->len)) {
+        errno = EINVAL;
+        goto fail;
+    }
+
+    return (0);
+
+fail:
+    close_journal (journal);
+    return (-1);
+}
+
+/*
+ * Append one packet. The journal has a single writer, so the head is
+ * only ever advanced here and needs no atomic read-modify-write.
+ */
+static inline void
+write_journal (const fence_kdump_journal_t *journal, const fence_kdump_addr_t *addr,
+               uint16_t port, const fence_kdump_msg_buf_t *msg, size_t len,
+               uint8_t verdict)
+{
+    uint64_t n;
+    struct timespec now;
+    fence_kdump_journal_entry_t *entry;
+
+    if (journal->head == NULL) {
+        return;
+    }
+
+    n = journal->head->head;
+    entry = &journal->entry[n % journal->head->slots];
+
+    __atomic_store_n (&entry->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence (__ATOMIC_RELEASE);
+
+    clock_gettime (CLOCK_REALTIME, &now);
+
+    entry->time = (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+    entry->addr = *addr;
+    entry->port = port;
+    entry->verdict = verdict;
+    entry->version = (len >= sizeof (msg->v1)) ? msg->v1.version : 0;
+
+    if ((len == sizeof (msg->v2)) && (msg->v2.magic == FENCE_KDUMP_MAGIC) &&
+        (msg->v2.version == FENCE_KDUMP_MSGV2)) {
+        memcpy (entry->node, msg->v2.node, sizeof (entry->node));
+        entry->msgseq = be64toh (msg->v2.seq);
+        entry->stage = be32toh (msg->v2.stage);
+    } else {
+        memset (entry->node, 0, sizeof (entry->node));
+        entry->msgseq = 0;
+        entry->stage = FENCE_KDUMP_STAGE_NONE;
+    }
+
+    __atomic_store_n (&entry->seq, n + 1, __ATOMIC_RELEASE);
+    __atomic_store_n (&journal->head->head, n + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Copy entry n (0-based) out of the ring. Returns 0 if the copy is
+ * consistent, -1 if the slot was reused or is being written.
+ */
+static inline int
+get_journal_entry (const fence_kdump_journal_t *journal, uint64_t n,
+                   fence_kdump_journal_entry_t *copy)
+{
+    uint64_t seq;
+    const fence_kdump_journal_entry_t *entry;
+
+    entry = &journal->entry[n % journal->head->slots];
+
+    seq = __atomic_load_n (&entry->seq, __ATOMIC_ACQUIRE);
+    if (seq != n + 1) {
+        return (-1);
+    }
+
+    memcpy (copy, (const void *) entry, sizeof (*copy));
+    __atomic_thread_fence (__ATOMIC_ACQUIRE);
+
+    return ((__atomic_load_n (&entry->seq, __ATOMIC_RELAXED) == seq) ? 0 : -1);
+}
+
+#endif /* _FENCE_KDUMP_JOURNAL_H */
@@ -0,0 +1,266 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*-
+ *
+ * Copyright (c) Ryan O'Hara (rohara@redhat.com)
+ * Copyright (c) Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#include "log.h"
+
+#define FENCE_KDUMP_LOG_SLOTS    256
+#define FENCE_KDUMP_LOG_LEN      256
+
+/*
+ * Messages are formatted into a ring by the main thread and written to
+ * stdout/stderr and syslog by a drain thread, so logging on the packet
+ * path costs no system call. There is a single producer and a single
+ * consumer: head is only advanced by the producer and tail only by the
+ * consumer. When the ring is full new messages are dropped and counted.
+ *
+ * An idle drain thread sleeps on a futex until a message is queued or
+ * logging stops. The producer only makes the wake-up call when the
+ * drain thread has said it is going to sleep.
+ */
+typedef struct fence_kdump_log_entry {
+    int priority;
+    char text[FENCE_KDUMP_LOG_LEN];
+} fence_kdump_log_entry_t;
+
+static fence_kdump_log_entry_t ring[FENCE_KDUMP_LOG_SLOTS];
+static unsigned int head = 0;
+static unsigned int tail = 0;
+static unsigned long dropped = 0;
+static int running = 0;
+static int stopping = 0;
+static int sleeping = 0;
+static int to_stderr = 0;
+static pthread_t drainer;
+
+static void
+write_entry (int priority, const char *text)
+{
+    if (priority <= LOG_ERR) {
+        fprintf (stderr, "[error]: %s", text);
+    } else {
+        fprintf ((to_stderr != 0) ? stderr : stdout, "[debug]: %s", text);
+    }
+
+    syslog (priority, "%s", text);
+}
+
+static int
+drain (void)
+{
+    int n = 0;
+    unsigned int h;
+    unsigned int t;
+    unsigned long lost;
+    char text[FENCE_KDUMP_LOG_LEN];
+
+    t = __atomic_load_n (&tail, __ATOMIC_RELAXED);
+    h = __atomic_load_n (&head, __ATOMIC_ACQUIRE);
+
+    for (; t != h; t++, n++) {
+        write_entry (ring[t % FENCE_KDUMP_LOG_SLOTS].priority,
+                     ring[t % FENCE_KDUMP_LOG_SLOTS].text);
+        __atomic_store_n (&tail, t + 1, __ATOMIC_RELEASE);
+    }
+
+    lost = __atomic_exchange_n (&dropped, 0, __ATOMIC_RELAXED);
+    if (lost != 0) {
+        snprintf (text, sizeof (text), "dropped %lu log messages\n", lost);
+        write_entry (LOG_WARNING, text);
+        n++;
+    }
+
+    if (n != 0) {
+        fflush (stdout);
+    }
+
+    return (n);
+}
+
+static void
+wake_drainer (void)
+{
+    /* pairs with the store of sleeping in drain_thread(): either the
+     * producer sees it set, or the drain thread sees the new message */
+    if (__atomic_exchange_n (&sleeping, 0, __ATOMIC_SEQ_CST) != 0) {
+        syscall (SYS_futex, &sleeping, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    }
+}
+
+static void *
+drain_thread (void *arg)
+{
+    int stop;
+    unsigned int t;
+
+    (void) arg;
+
+    /* stopping is read before draining, so whatever was queued before
+     * it was set is written before the thread exits */
+    for (;;) {
+        stop = __atomic_load_n (&stopping, __ATOMIC_ACQUIRE);
+        if (drain () != 0) {
+            continue;
+        }
+        if (stop != 0) {
+            break;
+        }
+
+        t = __atomic_load_n (&tail, __ATOMIC_RELAXED);
+
+        __atomic_store_n (&sleeping, 1, __ATOMIC_SEQ_CST);
+        if ((__atomic_load_n (&head, __ATOMIC_SEQ_CST) == t) &&
+            (__atomic_load_n (&dropped, __ATOMIC_SEQ_CST) == 0) &&
+            (__atomic_load_n (&stopping, __ATOMIC_SEQ_CST) == 0)) {
+            syscall (SYS_futex, &sleeping, FUTEX_WAIT_PRIVATE, 1, NULL, NULL, 0);
+        }
+        __atomic_store_n (&sleeping, 0, __ATOMIC_RELAXED);
+    }
+
+    return (NULL);
+}
+
+void
+log_init (void)
+{
+    sigset_t all;
+    sigset_t old;
+
+    /* signals are for the main thread, which may take them from a
+     * signalfd, so the drain thread starts with all of them blocked */
+    sigfillset (&all);
+    pthread_sigmask (SIG_SETMASK, &all, &old);
+
+    if (pthread_create (&drainer, NULL, drain_thread, NULL) == 0) {
+        running = 1;
+        atexit (log_exit);
+    }
+
+    pthread_sigmask (SIG_SETMASK, &old, NULL);
+}
+
+/* Leave stdout to the results; must be called before log_init(). */
+void
+log_to_stderr (void)
+{
+    to_stderr = 1;
+}
+
+void
+log_exit (void)
+{
+    if (running == 0) {
+        return;
+    }
+
+    __atomic_store_n (&stopping, 1, __ATOMIC_SEQ_CST);
+    wake_drainer ();
+    pthread_join (drainer, NULL);
+
+    running = 0;
+}
+
+/* Wait until everything queued so far has been written. */
+void
+log_flush (void)
+{
+    struct timespec delay = { 0, 1000000L };
+
+    while ((running != 0) &&
+           (__atomic_load_n (&tail, __ATOMIC_ACQUIRE) !=
+            __atomic_load_n (&head, __ATOMIC_RELAXED))) {
+        nanosleep (&delay, NULL);
+    }
+}
+
+static void queue_entry (int priority, const char *fmt, va_list ap)
+    __attribute__ ((format (printf, 2, 0)));
+static void queue_text (int priority, const char *fmt, ...)
+    __attribute__ ((format (printf, 2, 3)));
+
+static void
+queue_entry (int priority, const char *fmt, va_list ap)
+{
+    unsigned int h;
+    char text[FENCE_KDUMP_LOG_LEN];
+    fence_kdump_log_entry_t *entry;
+
+    if (running == 0) {
+        vsnprintf (text, sizeof (text), fmt, ap);
+        write_entry (priority, text);
+        return;
+    }
+
+    h = __atomic_load_n (&head, __ATOMIC_RELAXED);
+
+    if (h - __atomic_load_n (&tail, __ATOMIC_ACQUIRE) >= FENCE_KDUMP_LOG_SLOTS) {
+        __atomic_add_fetch (&dropped, 1, __ATOMIC_SEQ_CST);
+        wake_drainer ();
+        return;
+    }
+
+    entry = &ring[h % FENCE_KDUMP_LOG_SLOTS];
+    entry->priority = priority;
+    vsnprintf (entry->text, sizeof (entry->text), fmt, ap);
+
+    __atomic_store_n (&head, h + 1, __ATOMIC_SEQ_CST);
+    wake_drainer ();
+}
+
+static void
+queue_text (int priority, const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start (ap, fmt);
+    queue_entry (priority, fmt, ap);
+    va_end (ap);
+}
+
+void
+log_queue (int priority, fence_kdump_ratelimit_t *rl, const char *fmt, ...)
+{
+    va_list ap;
+    unsigned int suppressed = 0;
+
+    if ((rl != NULL) && !check_ratelimit (rl, &suppressed)) {
+        return;
+    }
+
+    if (suppressed != 0) {
+        queue_text (priority, "suppressed %u similar messages\n", suppressed);
+    }
+
+    va_start (ap, fmt);
+    queue_entry (priority, fmt, ap);
+    va_end (ap);
+}
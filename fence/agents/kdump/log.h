@@ -0,0 +1,79 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*-
+ *
+ * Copyright (c) Ryan O'Hara (rohara@redhat.com)
+ * Copyright (c) Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef _FENCE_KDUMP_LOG_H
+#define _FENCE_KDUMP_LOG_H
+
+#include <time.h>
+#include <syslog.h>
+
+/* messages a call site may log per second before it is rate limited */
+#define FENCE_KDUMP_LOG_BURST 10
+
+/*
+ * Per call site rate limit. Each log macro expansion owns one, so a
+ * flood of one kind of packet silences only the messages about it.
+ */
+typedef struct fence_kdump_ratelimit {
+    time_t window;
+    unsigned int count;
+    unsigned int suppressed;
+} fence_kdump_ratelimit_t;
+
+/*
+ * Returns 1 if the message may be logged. The number of messages
+ * suppressed in the previous window is returned once a new window
+ * starts, so it can be reported along with the next message.
+ */
+static inline int
+check_ratelimit (fence_kdump_ratelimit_t *rl, unsigned int *suppressed)
+{
+    struct timespec now;
+
+    clock_gettime (CLOCK_MONOTONIC_COARSE, &now);
+
+    *suppressed = 0;
+
+    if (now.tv_sec != rl->window) {
+        *suppressed = rl->suppressed;
+        rl->window = now.tv_sec;
+        rl->count = 0;
+        rl->suppressed = 0;
+    }
+
+    if (rl->count >= FENCE_KDUMP_LOG_BURST) {
+        rl->suppressed++;
+        return (0);
+    }
+
+    rl->count++;
+
+    return (1);
+}
+
+void log_init (void);
+void log_to_stderr (void);
+void log_exit (void);
+void log_flush (void);
+void log_queue (int priority, fence_kdump_ratelimit_t *rl, const char *fmt, ...)
+    __attribute__ ((format (printf, 3, 4)));
+
+#endif /* _FENCE_KDUMP_LOG_H */
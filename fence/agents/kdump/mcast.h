@@ -0,0 +1,122 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*-
+ *
+ * Copyright (c) Ryan O'Hara (rohara@redhat.com)
+ * Copyright (c) Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef _FENCE_KDUMP_MCAST_H
+#define _FENCE_KDUMP_MCAST_H
+
+#include <net/if.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "addr.h"
+
+#define FENCE_KDUMP_DEFAULT_TTL 1
+
+/*
+ * A message sent to a multicast group (or an IPv4 broadcast address)
+ * reaches every listener with one packet, so the sender does not need
+ * to know the cluster membership.
+ */
+static inline int
+is_addr_multicast (const fence_kdump_addr_t *addr)
+{
+    if (is_addr_v4mapped (addr)) {
+        return ((addr->bytes[12] & 0xf0) == 0xe0);
+    }
+
+    return (addr->bytes[0] == 0xff);
+}
+
+static inline int
+get_ifindex (const char *name, unsigned int *ifindex)
+{
+    *ifindex = 0;
+
+    if (name == NULL) {
+        return (0);
+    }
+
+    *ifindex = if_nametoindex (name);
+
+    return ((*ifindex != 0) ? 0 : -1);
+}
+
+static inline int
+set_multicast_send (int sock, const fence_kdump_addr_t *group,
+                    int ttl, unsigned int ifindex)
+{
+    int on = 1;
+    struct ip_mreqn mreq;
+
+    if (!is_addr_multicast (group)) {
+        if (!is_addr_v4mapped (group)) {
+            return (0);
+        }
+        return (setsockopt (sock, SOL_SOCKET, SO_BROADCAST, &on, sizeof (on)));
+    }
+
+    if (is_addr_v4mapped (group)) {
+        if (setsockopt (sock, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof (ttl)) != 0) {
+            return (-1);
+        }
+        if (ifindex != 0) {
+            memset (&mreq, 0, sizeof (mreq));
+            mreq.imr_ifindex = ifindex;
+            return (setsockopt (sock, IPPROTO_IP, IP_MULTICAST_IF, &mreq, sizeof (mreq)));
+        }
+    } else {
+        if (setsockopt (sock, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &ttl, sizeof (ttl)) != 0) {
+            return (-1);
+        }
+        if (ifindex != 0) {
+            return (setsockopt (sock, IPPROTO_IPV6, IPV6_MULTICAST_IF, &ifindex, sizeof (ifindex)));
+        }
+    }
+
+    return (0);
+}
+
+/*
+ * Join the group on a listening socket. An IPv4 group can be joined
+ * on a dual-stack IPv6 socket as well, its packets then arrive with
+ * v4-mapped source addresses like any other IPv4 sender.
+ */
+static inline int
+join_group (int sock, const fence_kdump_addr_t *group, unsigned int ifindex)
+{
+    struct ip_mreqn mreq;
+    struct ipv6_mreq mreq6;
+
+    if (is_addr_v4mapped (group)) {
+        memset (&mreq, 0, sizeof (mreq));
+        memcpy (&mreq.imr_multiaddr, &group->bytes[12], 4);
+        mreq.imr_ifindex = ifindex;
+        return (setsockopt (sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof (mreq)));
+    }
+
+    memset (&mreq6, 0, sizeof (mreq6));
+    memcpy (&mreq6.ipv6mr_multiaddr, group->bytes, 16);
+    mreq6.ipv6mr_interface = ifindex;
+
+    return (setsockopt (sock, IPPROTO_IPV6, IPV6_JOIN_GROUP, &mreq6, sizeof (mreq6)));
+}
+
+#endif /* _FENCE_KDUMP_MCAST_H */
@@ -22,15 +22,68 @@
 #ifndef _FENCE_KDUMP_MESSAGE_H
 #define _FENCE_KDUMP_MESSAGE_H
 
+#include <endian.h>
+
+#include "hmac.h"
+
 #define FENCE_KDUMP_MAGIC 0x1B302A40
 
 #define FENCE_KDUMP_MSGV1 0x1
+#define FENCE_KDUMP_MSGV2 0x2
+
+#define FENCE_KDUMP_NODE_ID_LEN 64
+#define FENCE_KDUMP_BOOT_ID_LEN 16
+#define FENCE_KDUMP_HMAC_LEN    16
+
+enum {
+    FENCE_KDUMP_STAGE_NONE   = 0,
+    FENCE_KDUMP_STAGE_BOOT   = 1,
+    FENCE_KDUMP_STAGE_SAVING = 2,
+    FENCE_KDUMP_STAGE_DONE   = 3,
+    FENCE_KDUMP_STAGE_FAILED = 4,
+};
+
+/* maximum difference in seconds between sender and receiver clocks */
+#define FENCE_KDUMP_MAX_SKEW 120
+
+#define FENCE_KDUMP_BATCH 64
 
 typedef struct __attribute__ ((packed)) fence_kdump_msg {
     uint32_t magic;
     uint32_t version;
 } fence_kdump_msg_t;
 
+/*
+ * Version 2 message. The magic and version keep the host byte order of
+ * version 1, all fields added in version 2 are in network byte order.
+ * The HMAC covers every byte that precedes it and is truncated to
+ * FENCE_KDUMP_HMAC_LEN bytes.
+ */
+typedef struct __attribute__ ((packed)) fence_kdump_msg_v2 {
+    uint32_t magic;
+    uint32_t version;
+    char node[FENCE_KDUMP_NODE_ID_LEN];
+    uint8_t boot_id[FENCE_KDUMP_BOOT_ID_LEN];
+    uint64_t seq;
+    uint64_t timestamp;
+    uint32_t stage;
+    uint64_t written;
+    uint64_t total;
+    uint8_t hmac[FENCE_KDUMP_HMAC_LEN];
+} fence_kdump_msg_v2_t;
+
+/* dump progress carried by version 2 messages, in host byte order */
+typedef struct fence_kdump_progress {
+    uint32_t stage;
+    uint64_t written;
+    uint64_t total;
+} fence_kdump_progress_t;
+
+typedef union fence_kdump_msg_buf {
+    fence_kdump_msg_t v1;
+    fence_kdump_msg_v2_t v2;
+} fence_kdump_msg_buf_t;
+
 static inline void
 init_message (fence_kdump_msg_t *msg)
 {
@@ -38,4 +91,91 @@ init_message (fence_kdump_msg_t *msg)
     msg->version = FENCE_KDUMP_MSGV1;
 }
 
+static inline void
+init_message_v2 (fence_kdump_msg_v2_t *msg, const char *node, const uint8_t *boot_id)
+{
+    memset (msg, 0, sizeof (*msg));
+
+    msg->magic   = FENCE_KDUMP_MAGIC;
+    msg->version = FENCE_KDUMP_MSGV2;
+
+    strncpy (msg->node, node, sizeof (msg->node) - 1);
+    memcpy (msg->boot_id, boot_id, sizeof (msg->boot_id));
+}
+
+static inline const char *
+stage_name (uint32_t stage)
+{
+    switch (stage) {
+    case FENCE_KDUMP_STAGE_BOOT:
+        return ("boot");
+    case FENCE_KDUMP_STAGE_SAVING:
+        return ("saving");
+    case FENCE_KDUMP_STAGE_DONE:
+        return ("done");
+    case FENCE_KDUMP_STAGE_FAILED:
+        return ("failed");
+    default:
+        return ("none");
+    }
+}
+
+static inline int
+parse_stage (const char *arg)
+{
+    uint32_t stage;
+
+    for (stage = FENCE_KDUMP_STAGE_NONE; stage <= FENCE_KDUMP_STAGE_FAILED; stage++) {
+        if (!strcasecmp (arg, stage_name (stage))) {
+            return (stage);
+        }
+    }
+
+    return (-1);
+}
+
+static inline int
+progress_percent (const fence_kdump_progress_t *progress)
+{
+    if ((progress->total == 0) || (progress->written > progress->total)) {
+        return ((progress->stage == FENCE_KDUMP_STAGE_DONE) ? 100 : -1);
+    }
+
+    return ((int) (progress->written * 100 / progress->total));
+}
+
+static inline void
+get_progress (const fence_kdump_msg_v2_t *msg, fence_kdump_progress_t *progress)
+{
+    progress->stage   = be32toh (msg->stage);
+    progress->written = be64toh (msg->written);
+    progress->total   = be64toh (msg->total);
+}
+
+static inline void
+sign_message_v2 (fence_kdump_msg_v2_t *msg, const hmac_ctx_t *hmac,
+                 uint64_t seq, uint64_t timestamp,
+                 const fence_kdump_progress_t *progress)
+{
+    msg->seq       = htobe64 (seq);
+    msg->timestamp = htobe64 (timestamp);
+    msg->stage     = htobe32 (progress->stage);
+    msg->written   = htobe64 (progress->written);
+    msg->total     = htobe64 (progress->total);
+
+    hmac_digest (hmac, msg, offsetof (fence_kdump_msg_v2_t, hmac),
+                 msg->hmac, sizeof (msg->hmac));
+}
+
+static inline int
+verify_message_v2 (const fence_kdump_msg_v2_t *msg, const hmac_ctx_t *hmac)
+{
+    uint8_t digest[FENCE_KDUMP_HMAC_LEN];
+
+    hmac_digest (hmac, msg, offsetof (fence_kdump_msg_v2_t, hmac),
+                 digest, sizeof (digest));
+
+    return (hmac_equal (digest, msg->hmac, sizeof (digest)));
+}
+
 #endif /* _FENCE_KDUMP_MESSAGE_H */
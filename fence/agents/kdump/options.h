@@ -22,12 +22,30 @@
 #ifndef _FENCE_KDUMP_OPTIONS_H
 #define _FENCE_KDUMP_OPTIONS_H
 
-#include "list.h"
+#include <errno.h>
+#include <fcntl.h>
+
+#include "addr.h"
+#include "mcast.h"
+#include "journal.h"
+#include "resolve.h"
+#include "message.h"
+#include "output.h"
+#include "packet.h"
 
 #define FENCE_KDUMP_NAME_LEN 256
 #define FENCE_KDUMP_ADDR_LEN 46
 #define FENCE_KDUMP_PORT_LEN 6
 
+#define FENCE_KDUMP_NODE_SEP ", \t"
+
+#define FENCE_KDUMP_MAX_SOCKETS 8
+
+/* node limit of the static fence_kdump_send */
+#define FENCE_KDUMP_STATIC_NODES 64
+
+#define FENCE_KDUMP_MAX_KEY_LEN 1024
+
 enum {
     FENCE_KDUMP_ACTION_OFF      = 0,
     FENCE_KDUMP_ACTION_ON       = 1,
@@ -44,13 +62,176 @@ enum {
     FENCE_KDUMP_FAMILY_IPV4 = AF_INET,
 };
 
+enum {
+    FENCE_KDUMP_PACKET_NONE     = 0,
+    FENCE_KDUMP_PACKET_FALLBACK = 1,
+    FENCE_KDUMP_PACKET_ALWAYS   = 2,
+};
+
 #define FENCE_KDUMP_DEFAULT_IPPORT   7410
 #define FENCE_KDUMP_DEFAULT_FAMILY   0
 #define FENCE_KDUMP_DEFAULT_ACTION   0
 #define FENCE_KDUMP_DEFAULT_COUNT    0
 #define FENCE_KDUMP_DEFAULT_INTERVAL 10
+#define FENCE_KDUMP_DEFAULT_BURST    5
+#define FENCE_KDUMP_DEFAULT_BURST_INTERVAL 200
 #define FENCE_KDUMP_DEFAULT_TIMEOUT  60
 #define FENCE_KDUMP_DEFAULT_VERBOSE  0
+#define FENCE_KDUMP_DEFAULT_ALLOW_V1 0
+#define FENCE_KDUMP_DEFAULT_DAEMON   0
+#define FENCE_KDUMP_DEFAULT_REUSEPORT 0
+#define FENCE_KDUMP_DEFAULT_SOCKET   "/var/run/fence_kdump.sock"
+
+/*
+ * Time in nanoseconds from the kernel receiving a message (wire) and
+ * from the sender stamping it (send) to the agent accepting it. The
+ * send latency is only meaningful with synchronized clocks.
+ */
+typedef struct fence_kdump_latency {
+    int64_t wire;
+    int64_t send;
+    int flags;
+} fence_kdump_latency_t;
+
+#define FENCE_KDUMP_LATENCY_WIRE 0x1
+#define FENCE_KDUMP_LATENCY_SEND 0x2
+
+typedef union fence_kdump_sockaddr {
+    struct sockaddr sa;
+    struct sockaddr_in sin;
+    struct sockaddr_in6 sin6;
+} fence_kdump_sockaddr_t;
+
+/* what is only needed to set a node up, to log and to report it */
+typedef struct fence_kdump_node_info {
+    char name[FENCE_KDUMP_NAME_LEN];
+    char addr[FENCE_KDUMP_ADDR_LEN];
+    char port[FENCE_KDUMP_PORT_LEN];
+    int family;
+    fence_kdump_addr_t keys[FENCE_KDUMP_MAX_ADDRS];
+    int nkeys;
+    /* sender and identity of the message accepted from the node */
+    fence_kdump_addr_t from;
+    char id[FENCE_KDUMP_NODE_ID_LEN + 1];
+} fence_kdump_node_info_t;
+
+/*
+ * What is touched for every message sent or received. The sender only
+ * reads the first fields.
+ */
+typedef struct fence_kdump_node {
+    int socket;
+    socklen_t sslen;
+    fence_kdump_sockaddr_t sa;
+    int fenced;
+    uint64_t seq;
+    uint8_t boot_id[FENCE_KDUMP_BOOT_ID_LEN];
+    fence_kdump_progress_t progress;
+    struct timespec last;
+    fence_kdump_latency_t latency;
+    fence_kdump_node_info_t *info;
+} fence_kdump_node_t;
+
+/*
+ * Nodes are kept in one block allocated for all of them: the array of
+ * node states, walked on every round, followed by the array of their
+ * infos. Nodes never move, so the address set that indexes them can
+ * point at them. The static build uses fixed arrays instead, two of
+ * them so that a new table can be built while the old one is in use.
+ */
+typedef struct fence_kdump_nodes {
+    fence_kdump_node_t *node;
+    fence_kdump_node_info_t *info;
+    int count;
+    int size;
+} fence_kdump_nodes_t;
+
+#ifdef FENCE_KDUMP_STATIC
+static fence_kdump_node_t static_node_table[2][FENCE_KDUMP_STATIC_NODES];
+static fence_kdump_node_info_t static_info_table[2][FENCE_KDUMP_STATIC_NODES];
+static int static_table_used[2];
+#endif
+
+#define for_each_node(pos, nodes) \
+    for ((pos) = (nodes)->node; (pos) < (nodes)->node + (nodes)->count; (pos)++)
+
+static inline void
+init_nodes (fence_kdump_nodes_t *nodes)
+{
+    nodes->node = NULL;
+    nodes->info = NULL;
+    nodes->count = 0;
+    nodes->size = 0;
+}
+
+static inline void
+free_nodes (fence_kdump_nodes_t *nodes)
+{
+#ifdef FENCE_KDUMP_STATIC
+    if (nodes->node != NULL) {
+        static_table_used[nodes->node == static_node_table[1]] = 0;
+    }
+#else
+    free (nodes->node);
+#endif
+    init_nodes (nodes);
+}
+
+static inline int
+alloc_nodes (fence_kdump_nodes_t *nodes, int size)
+{
+#ifdef FENCE_KDUMP_STATIC
+    int i = (static_table_used[0] != 0);
+
+    if ((size > FENCE_KDUMP_STATIC_NODES) || (static_table_used[i] != 0)) {
+        errno = ENOMEM;
+        return (-1);
+    }
+
+    static_table_used[i] = 1;
+    nodes->node = static_node_table[i];
+    nodes->info = static_info_table[i];
+#else
+    nodes->node = calloc (size, sizeof (fence_kdump_node_t) + sizeof (fence_kdump_node_info_t));
+    if (!nodes->node) {
+        return (-1);
+    }
+
+    nodes->info = (fence_kdump_node_info_t *) (nodes->node + size);
+#endif
+    nodes->count = 0;
+    nodes->size = size;
+
+    return (0);
+}
+
+/* Returns the next free node, cleared, or NULL if the table is full. */
+static inline fence_kdump_node_t *
+add_node (fence_kdump_nodes_t *nodes)
+{
+    fence_kdump_node_t *node;
+
+    if (nodes->count >= nodes->size) {
+        return (NULL);
+    }
+
+    node = &nodes->node[nodes->count];
+    memset (node, 0, sizeof (*node));
+
+    node->info = &nodes->info[nodes->count++];
+    memset (node->info, 0, sizeof (*node->info));
+
+    node->socket = -1;
+
+    return (node);
+}
+
+/* gives the last node added back */
+static inline void
+drop_node (fence_kdump_nodes_t *nodes)
+{
+    nodes->count--;
+}
 
 typedef struct fence_kdump_opts {
     char *nodename;
@@ -59,42 +240,77 @@ typedef struct fence_kdump_opts {
     int action;
     int count;
     int interval;
+    int burst;
+    int burst_interval;
     int timeout;
     int verbose;
-    struct list_head nodes;
+    char *keyfile;
+    char *identity;
+    int allow_v1;
+    int keyed;
+    int daemon;
+    int reuseport;
+    int activated;
+    int report;
+    int feed;
+    int output;
+    int packet;
+    fence_kdump_progress_t progress;
+    char *sockpath;
+    char *journalpath;
+    char *cachepath;
+    char *seenpath;
+    char *peerpath;
+    int resolve_timeout;
+    char *group;
+    char *interface;
+    int ttl;
+    int control;
+    hmac_ctx_t hmac;
+    fence_kdump_journal_t journal;
+    int sockets[FENCE_KDUMP_MAX_SOCKETS];
+    int nsockets;
+    fence_kdump_ring_t ring;
+    int pending;
+    struct timespec started;
+    fence_kdump_addrset_t addrs;
+    fence_kdump_nodes_t nodes;
 } fence_kdump_opts_t;
 
-typedef struct fence_kdump_node {
-    char name[FENCE_KDUMP_NAME_LEN];
-    char addr[FENCE_KDUMP_ADDR_LEN];
-    char port[FENCE_KDUMP_PORT_LEN];
-    int socket;
-    struct addrinfo *info;
-    struct list_head list;
-} fence_kdump_node_t;
-
 static inline void
-init_node (fence_kdump_node_t *node)
+print_node (FILE *fp, const fence_kdump_node_t *node)
 {
-    node->info = NULL;
+    fprintf (fp, "[debug]: node {       \n");
+    fprintf (fp, "[debug]:     name = %s\n", node->info->name);
+    fprintf (fp, "[debug]:     addr = %s\n", node->info->addr);
+    fprintf (fp, "[debug]:     port = %s\n", node->info->port);
+    fprintf (fp, "[debug]:     keys = %d\n", node->info->nkeys);
+    fprintf (fp, "[debug]: }            \n");
 }
 
+/*
+ * Option strings are copies, except in the static build, which does
+ * not allocate: there they point at the argument itself, a command
+ * line word or a literal that lives as long as the process.
+ */
 static inline void
-free_node (fence_kdump_node_t *node)
+set_option_string (char **opt, const char *arg)
 {
-    freeaddrinfo (node->info);
-    free (node);
+#ifdef FENCE_KDUMP_STATIC
+    *opt = (char *) arg;
+#else
+    free (*opt);
+    *opt = strdup (arg);
+#endif
 }
 
 static inline void
-print_node (const fence_kdump_node_t *node)
+free_option_string (char **opt)
 {
-    fprintf (stdout, "[debug]: node {       \n");
-    fprintf (stdout, "[debug]:     name = %s\n", node->name);
-    fprintf (stdout, "[debug]:     addr = %s\n", node->addr);
-    fprintf (stdout, "[debug]:     port = %s\n", node->port);
-    fprintf (stdout, "[debug]:     info = %p\n", node->info);
-    fprintf (stdout, "[debug]: }            \n");
+#ifndef FENCE_KDUMP_STATIC
+    free (*opt);
+#endif
+    *opt = NULL;
 }
 
 static inline void
@@ -106,54 +322,126 @@ init_options (fence_kdump_opts_t *opts)
     opts->action   = FENCE_KDUMP_DEFAULT_ACTION;
     opts->count    = FENCE_KDUMP_DEFAULT_COUNT;
     opts->interval = FENCE_KDUMP_DEFAULT_INTERVAL;
+    opts->burst    = FENCE_KDUMP_DEFAULT_BURST;
+    opts->burst_interval = FENCE_KDUMP_DEFAULT_BURST_INTERVAL;
     opts->timeout  = FENCE_KDUMP_DEFAULT_TIMEOUT;
     opts->verbose  = FENCE_KDUMP_DEFAULT_VERBOSE;
-
-    INIT_LIST_HEAD (&opts->nodes);
+    opts->keyfile  = NULL;
+    opts->identity = NULL;
+    opts->allow_v1 = FENCE_KDUMP_DEFAULT_ALLOW_V1;
+    opts->keyed    = 0;
+    opts->daemon   = FENCE_KDUMP_DEFAULT_DAEMON;
+    opts->reuseport = FENCE_KDUMP_DEFAULT_REUSEPORT;
+    opts->activated = 0;
+    opts->report   = 0;
+    opts->feed     = 0;
+    opts->output   = FENCE_KDUMP_OUTPUT_NONE;
+    opts->packet   = FENCE_KDUMP_PACKET_NONE;
+    opts->sockpath = NULL;
+    set_option_string (&opts->sockpath, FENCE_KDUMP_DEFAULT_SOCKET);
+    opts->journalpath = NULL;
+    opts->cachepath = NULL;
+    opts->seenpath = NULL;
+    opts->peerpath = NULL;
+    opts->resolve_timeout = FENCE_KDUMP_DEFAULT_RESOLVE_TIMEOUT;
+    opts->group    = NULL;
+    opts->interface = NULL;
+    opts->ttl      = FENCE_KDUMP_DEFAULT_TTL;
+    opts->control  = -1;
+
+    memset (&opts->progress, 0, sizeof (opts->progress));
+    init_journal (&opts->journal);
+    opts->nsockets = 0;
+    init_ring (&opts->ring);
+    opts->pending  = 0;
+
+    init_addrset (&opts->addrs);
+    init_nodes (&opts->nodes);
 }
 
 static inline void
 free_options (fence_kdump_opts_t *opts)
 {
-    fence_kdump_node_t *node;
-    fence_kdump_node_t *safe;
+    while (opts->nsockets > 0) {
+        close (opts->sockets[--opts->nsockets]);
+    }
+
+    free_ring (&opts->ring);
 
-    list_for_each_entry_safe (node, safe, &opts->nodes, list) {
-        list_del (&node->list);
-        free_node (node);
+    if (opts->control >= 0) {
+        close (opts->control);
+        opts->control = -1;
     }
 
-    free (opts->nodename);
+    free_nodes (&opts->nodes);
+
+    close_journal (&opts->journal);
+    free_addrset (&opts->addrs);
+    free_option_string (&opts->nodename);
+    free_option_string (&opts->keyfile);
+    free_option_string (&opts->identity);
+    free_option_string (&opts->sockpath);
+    free_option_string (&opts->journalpath);
+    free_option_string (&opts->cachepath);
+    free_option_string (&opts->seenpath);
+    free_option_string (&opts->peerpath);
+    free_option_string (&opts->group);
+    free_option_string (&opts->interface);
+
+    memset (&opts->hmac, 0, sizeof (opts->hmac));
 }
 
 static inline void
 print_options (fence_kdump_opts_t *opts)
 {
     fence_kdump_node_t *node;
-
-    fprintf (stdout, "[debug]: options {        \n");
-    fprintf (stdout, "[debug]:     nodename = %s\n", opts->nodename);
-    fprintf (stdout, "[debug]:     ipport   = %d\n", opts->ipport);
-    fprintf (stdout, "[debug]:     family   = %d\n", opts->family);
-    fprintf (stdout, "[debug]:     count    = %d\n", opts->count);
-    fprintf (stdout, "[debug]:     interval = %d\n", opts->interval);
-    fprintf (stdout, "[debug]:     timeout  = %d\n", opts->timeout);
-    fprintf (stdout, "[debug]:     verbose  = %d\n", opts->verbose);
-    fprintf (stdout, "[debug]: }                \n");
-
-    list_for_each_entry (node, &opts->nodes, list) {
-        print_node (node);
+    FILE *fp;
+
+    /* with --output, stdout carries only the verdicts */
+    fp = (opts->output != FENCE_KDUMP_OUTPUT_NONE) ? stderr : stdout;
+
+    fprintf (fp, "[debug]: options {        \n");
+    fprintf (fp, "[debug]:     nodename = %s\n", opts->nodename);
+    fprintf (fp, "[debug]:     ipport   = %d\n", opts->ipport);
+    fprintf (fp, "[debug]:     family   = %d\n", opts->family);
+    fprintf (fp, "[debug]:     count    = %d\n", opts->count);
+    fprintf (fp, "[debug]:     interval = %d\n", opts->interval);
+    fprintf (fp, "[debug]:     burst    = %d\n", opts->burst);
+    fprintf (fp, "[debug]:     burst_interval = %d\n", opts->burst_interval);
+    fprintf (fp, "[debug]:     timeout  = %d\n", opts->timeout);
+    fprintf (fp, "[debug]:     verbose  = %d\n", opts->verbose);
+    fprintf (fp, "[debug]:     keyfile  = %s\n", opts->keyfile);
+    fprintf (fp, "[debug]:     identity = %s\n", opts->identity);
+    fprintf (fp, "[debug]:     allow_v1 = %d\n", opts->allow_v1);
+    fprintf (fp, "[debug]:     daemon   = %d\n", opts->daemon);
+    fprintf (fp, "[debug]:     reuseport = %d\n", opts->reuseport);
+    fprintf (fp, "[debug]:     activated = %d\n", opts->activated);
+    fprintf (fp, "[debug]:     sockpath = %s\n", opts->sockpath);
+    fprintf (fp, "[debug]:     journal  = %s\n", opts->journalpath);
+    fprintf (fp, "[debug]:     cache    = %s\n", opts->cachepath);
+    fprintf (fp, "[debug]:     seen     = %s\n", opts->seenpath);
+    fprintf (fp, "[debug]:     peers    = %s\n", opts->peerpath);
+    fprintf (fp, "[debug]:     resolve_timeout = %d\n", opts->resolve_timeout);
+    fprintf (fp, "[debug]:     group    = %s\n", opts->group);
+    fprintf (fp, "[debug]:     interface = %s\n", opts->interface);
+    fprintf (fp, "[debug]:     ttl      = %d\n", opts->ttl);
+    fprintf (fp, "[debug]:     stage    = %s\n", stage_name (opts->progress.stage));
+    fprintf (fp, "[debug]:     written  = %llu\n", (unsigned long long) opts->progress.written);
+    fprintf (fp, "[debug]:     total    = %llu\n", (unsigned long long) opts->progress.total);
+    fprintf (fp, "[debug]:     feed     = %d\n", opts->feed);
+    fprintf (fp, "[debug]:     output   = %d\n", opts->output);
+    fprintf (fp, "[debug]:     packet   = %d\n", opts->packet);
+    fprintf (fp, "[debug]: }                \n");
+
+    for_each_node (node, &opts->nodes) {
+        print_node (fp, node);
     }
 }
 
 static inline void
 set_option_nodename (fence_kdump_opts_t *opts, const char *arg)
 {
-    if (opts->nodename != NULL) {
-        free (opts->nodename);
-    }
-
-    opts->nodename = strdup (arg);
+    set_option_string (&opts->nodename, arg);
 }
 
 static inline void
@@ -187,6 +475,10 @@ set_option_action (fence_kdump_opts_t *opts, const char *arg)
 {
     if (!strcasecmp (arg, "off")) {
         opts->action = FENCE_KDUMP_ACTION_OFF;
+    } else if (!strcasecmp (arg, "status")) {
+        opts->action = FENCE_KDUMP_ACTION_STATUS;
+    } else if (!strcasecmp (arg, "monitor")) {
+        opts->action = FENCE_KDUMP_ACTION_MONITOR;
     } else if (!strcasecmp (arg, "metadata")) {
         opts->action = FENCE_KDUMP_ACTION_METADATA;
     } else {
@@ -217,6 +509,28 @@ set_option_interval (fence_kdump_opts_t *opts, const char *arg)
     }
 }
 
+static inline void
+set_option_burst (fence_kdump_opts_t *opts, const char *arg)
+{
+    opts->burst = atoi (arg);
+
+    if (opts->burst < 0) {
+        fprintf (stderr, "[error]: invalid burst '%s'\n", arg);
+        exit (1);
+    }
+}
+
+static inline void
+set_option_burst_interval (fence_kdump_opts_t *opts, const char *arg)
+{
+    opts->burst_interval = atoi (arg);
+
+    if (opts->burst_interval < 1) {
+        fprintf (stderr, "[error]: invalid burst interval '%s'\n", arg);
+        exit (1);
+    }
+}
+
 static inline void
 set_option_timeout (fence_kdump_opts_t *opts, const char *arg)
 {
@@ -238,4 +552,227 @@ set_option_verbose (fence_kdump_opts_t *opts, const char *arg)
     }
 }
 
+static inline void
+set_option_keyfile (fence_kdump_opts_t *opts, const char *arg)
+{
+    set_option_string (&opts->keyfile, arg);
+}
+
+static inline void
+set_option_identity (fence_kdump_opts_t *opts, const char *arg)
+{
+    set_option_string (&opts->identity, arg);
+}
+
+static inline void
+set_option_allow_v1 (fence_kdump_opts_t *opts, const char *arg)
+{
+    if (arg != NULL) {
+        opts->allow_v1 = atoi (arg);
+    } else {
+        opts->allow_v1 = 1;
+    }
+}
+
+static inline void
+set_option_daemon (fence_kdump_opts_t *opts, const char *arg)
+{
+    if (arg != NULL) {
+        opts->daemon = atoi (arg);
+    } else {
+        opts->daemon = 1;
+    }
+}
+
+static inline void
+set_option_reuseport (fence_kdump_opts_t *opts, const char *arg)
+{
+    if (arg != NULL) {
+        opts->reuseport = atoi (arg);
+    } else {
+        opts->reuseport = 1;
+    }
+}
+
+static inline void
+set_option_sockpath (fence_kdump_opts_t *opts, const char *arg)
+{
+    set_option_string (&opts->sockpath, arg);
+}
+
+static inline void
+set_option_journal (fence_kdump_opts_t *opts, const char *arg)
+{
+    set_option_string (&opts->journalpath, arg);
+}
+
+static inline void
+set_option_cache (fence_kdump_opts_t *opts, const char *arg)
+{
+    set_option_string (&opts->cachepath, arg);
+}
+
+static inline void
+set_option_peers (fence_kdump_opts_t *opts, const char *arg)
+{
+    set_option_string (&opts->peerpath, arg);
+}
+
+static inline void
+set_option_seen (fence_kdump_opts_t *opts, const char *arg)
+{
+    set_option_string (&opts->seenpath, arg);
+}
+
+static inline void
+set_option_output (fence_kdump_opts_t *opts, const char *arg)
+{
+    opts->output = parse_output (arg);
+
+    if (opts->output < 0) {
+        fprintf (stderr, "[error]: unsupported output format '%s'\n", arg);
+        exit (1);
+    }
+}
+
+static inline void
+set_option_packet (fence_kdump_opts_t *opts, const char *arg)
+{
+    if (!strcasecmp (arg, "none")) {
+        opts->packet = FENCE_KDUMP_PACKET_NONE;
+    } else if (!strcasecmp (arg, "fallback")) {
+        opts->packet = FENCE_KDUMP_PACKET_FALLBACK;
+    } else if (!strcasecmp (arg, "always")) {
+        opts->packet = FENCE_KDUMP_PACKET_ALWAYS;
+    } else {
+        fprintf (stderr, "[error]: unsupported packet mode '%s'\n", arg);
+        exit (1);
+    }
+}
+
+static inline void
+set_option_resolve_timeout (fence_kdump_opts_t *opts, const char *arg)
+{
+    opts->resolve_timeout = atoi (arg);
+
+    if (opts->resolve_timeout < 1) {
+        fprintf (stderr, "[error]: invalid resolve timeout '%s'\n", arg);
+        exit (1);
+    }
+}
+
+static inline void
+set_option_multicast (fence_kdump_opts_t *opts, const char *arg)
+{
+    fence_kdump_addr_t addr;
+
+    if (parse_addr (&addr, arg) != 0) {
+        fprintf (stderr, "[error]: invalid multicast group '%s'\n", arg);
+        exit (1);
+    }
+
+    set_option_string (&opts->group, arg);
+}
+
+static inline void
+set_option_interface (fence_kdump_opts_t *opts, const char *arg)
+{
+    set_option_string (&opts->interface, arg);
+}
+
+static inline void
+set_option_ttl (fence_kdump_opts_t *opts, const char *arg)
+{
+    opts->ttl = atoi (arg);
+
+    if ((opts->ttl < 1) || (opts->ttl > 255)) {
+        fprintf (stderr, "[error]: invalid ttl '%s'\n", arg);
+        exit (1);
+    }
+}
+
+static inline void
+set_option_stage (fence_kdump_opts_t *opts, const char *arg)
+{
+    int stage = parse_stage (arg);
+
+    if (stage < 0) {
+        fprintf (stderr, "[error]: unsupported stage '%s'\n", arg);
+        exit (1);
+    }
+
+    opts->progress.stage = stage;
+    opts->report = 1;
+}
+
+static inline void
+set_option_progress (fence_kdump_opts_t *opts, const char *arg)
+{
+    char *end;
+
+    opts->progress.written = strtoull (arg, &end, 10);
+
+    if (*end == '/') {
+        opts->progress.total = strtoull (end + 1, &end, 10);
+    }
+
+    if ((end == arg) || (*end != 0)) {
+        fprintf (stderr, "[error]: invalid progress '%s'\n", arg);
+        exit (1);
+    }
+
+    opts->report = 1;
+}
+
+static inline void
+set_option_feed (fence_kdump_opts_t *opts, const char *arg)
+{
+    if (arg != NULL) {
+        opts->feed = atoi (arg);
+    } else {
+        opts->feed = 1;
+    }
+
+    opts->report |= opts->feed;
+}
+
+/*
+ * Prepare the HMAC context used for version 2 messages. Without a key
+ * file the context is keyed with the empty key, which only protects
+ * against corruption.
+ */
+static inline int
+get_options_key (fence_kdump_opts_t *opts)
+{
+    int fd;
+    ssize_t len;
+    uint8_t key[FENCE_KDUMP_MAX_KEY_LEN];
+
+    if (opts->keyfile == NULL) {
+        hmac_init (&opts->hmac, NULL, 0);
+        return (0);
+    }
+
+    fd = open (opts->keyfile, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf (stderr, "[error]: open '%s' (%s)\n", opts->keyfile, strerror (errno));
+        return (1);
+    }
+
+    len = read (fd, key, sizeof (key));
+    close (fd);
+
+    if (len <= 0) {
+        fprintf (stderr, "[error]: empty or unreadable key file '%s'\n", opts->keyfile);
+        return (1);
+    }
+
+    hmac_init (&opts->hmac, key, len);
+    memset (key, 0, sizeof (key));
+
+    opts->keyed = 1;
+
+    return (0);
+}
+
 #endif /* _FENCE_KDUMP_OPTIONS_H */
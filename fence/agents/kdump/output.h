@@ -0,0 +1,144 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*-
+ *
+ * Copyright (c) Ryan O'Hara (rohara@redhat.com)
+ * Copyright (c) Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef _FENCE_KDUMP_OUTPUT_H
+#define _FENCE_KDUMP_OUTPUT_H
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+/*
+ * Per-node results for the caller, one line each: "key=value" fields
+ * separated by spaces, or one JSON object. Each line is flushed as soon
+ * as it is complete, so a caller reading a pipe sees it at once.
+ */
+
+enum {
+    FENCE_KDUMP_OUTPUT_NONE = 0,
+    FENCE_KDUMP_OUTPUT_KV   = 1,
+    FENCE_KDUMP_OUTPUT_JSON = 2,
+};
+
+typedef struct fence_kdump_output {
+    FILE *fp;
+    int format;
+    int fields;
+} fence_kdump_output_t;
+
+static inline int
+parse_output (const char *arg)
+{
+    if (!strcasecmp (arg, "none")) {
+        return (FENCE_KDUMP_OUTPUT_NONE);
+    }
+    if (!strcasecmp (arg, "kv")) {
+        return (FENCE_KDUMP_OUTPUT_KV);
+    }
+    if (!strcasecmp (arg, "json")) {
+        return (FENCE_KDUMP_OUTPUT_JSON);
+    }
+
+    return (-1);
+}
+
+static inline void
+begin_output (fence_kdump_output_t *out, FILE *fp, int format)
+{
+    out->fp = fp;
+    out->format = format;
+    out->fields = 0;
+
+    if (format == FENCE_KDUMP_OUTPUT_JSON) {
+        fputc ('{', fp);
+    }
+}
+
+static inline void
+add_output_key (fence_kdump_output_t *out, const char *key)
+{
+    if (out->format == FENCE_KDUMP_OUTPUT_JSON) {
+        fprintf (out->fp, "%s\"%s\":", (out->fields > 0) ? "," : "", key);
+    } else {
+        fprintf (out->fp, "%s%s=", (out->fields > 0) ? " " : "", key);
+    }
+
+    out->fields++;
+}
+
+static inline void
+add_output_str (fence_kdump_output_t *out, const char *key, const char *value)
+{
+    const unsigned char *p;
+
+    add_output_key (out, key);
+
+    /* values may come off the wire, keep "key=value" parseable */
+    if (out->format != FENCE_KDUMP_OUTPUT_JSON) {
+        for (p = (const unsigned char *) value; *p != 0; p++) {
+            fputc (((*p > ' ') && (*p < 0x7f) && (*p != '=')) ? *p : '_', out->fp);
+        }
+        return;
+    }
+
+    fputc ('"', out->fp);
+    for (p = (const unsigned char *) value; *p != 0; p++) {
+        if ((*p == '"') || (*p == '\\')) {
+            fprintf (out->fp, "\\%c", *p);
+        } else if (*p < 0x20) {
+            fprintf (out->fp, "\\u%04x", *p);
+        } else {
+            fputc (*p, out->fp);
+        }
+    }
+    fputc ('"', out->fp);
+}
+
+static inline void
+add_output_int (fence_kdump_output_t *out, const char *key, long long value)
+{
+    add_output_key (out, key);
+
+    fprintf (out->fp, "%lld", value);
+}
+
+/* seconds with nanoseconds, a plain number in either format */
+static inline void
+add_output_time (fence_kdump_output_t *out, const char *key, const struct timespec *ts)
+{
+    add_output_key (out, key);
+
+    fprintf (out->fp, "%lld.%09ld", (long long) ts->tv_sec, ts->tv_nsec);
+}
+
+static inline void
+end_output (fence_kdump_output_t *out)
+{
+    if (out->format == FENCE_KDUMP_OUTPUT_JSON) {
+        fputc ('}', out->fp);
+    }
+
+    fputc ('\n', out->fp);
+    fflush (out->fp);
+}
+
+#endif /* _FENCE_KDUMP_OUTPUT_H */
@@ -0,0 +1,296 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*-
+ *
+ * Copyright (c) Ryan O'Hara (rohara@redhat.com)
+ * Copyright (c) Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef _FENCE_KDUMP_PACKET_H
+#define _FENCE_KDUMP_PACKET_H
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+
+#include "filter.h"
+
+/*
+ * Packets for the port captured with a TPACKET_V3 receive ring, for
+ * when the port cannot be bound or a firewall drops what arrives for
+ * it. The capture sits before both, and is read only: nothing is sent
+ * and the packets still go where they would have gone. The kernel
+ * fills blocks of the ring mapped into the agent and hands over a
+ * block once it is full or has waited FENCE_KDUMP_RING_TIMEOUT
+ * milliseconds; messages are checked right where they lie.
+ *
+ * Unlike a UDP socket, the ring does not check the UDP checksum or
+ * reassemble fragments (which a message never needs).
+ */
+
+#define FENCE_KDUMP_RING_BLOCK_SIZE (1 << 16)
+#define FENCE_KDUMP_RING_BLOCKS     8
+#define FENCE_KDUMP_RING_FRAME_SIZE 2048
+#define FENCE_KDUMP_RING_TIMEOUT    2
+
+/* network and UDP headers, and more than the largest message */
+#define FENCE_KDUMP_RING_SNAPLEN    256
+
+#define FENCE_KDUMP_IPV4_HLEN 20
+#define FENCE_KDUMP_IPV6_HLEN 40
+#define FENCE_KDUMP_UDP_PROTO 17
+
+typedef struct fence_kdump_ring {
+    int sock;
+    uint8_t *map;
+    size_t size;
+    unsigned int block;
+    unsigned int left;
+    struct tpacket3_hdr *next;
+} fence_kdump_ring_t;
+
+/* one UDP payload in the ring, valid until the next datagram is taken */
+typedef struct fence_kdump_datagram {
+    const uint8_t *data;
+    size_t len;
+    int truncated;
+    struct sockaddr_storage from;
+    struct timespec rx;
+} fence_kdump_datagram_t;
+
+static inline void
+init_ring (fence_kdump_ring_t *ring)
+{
+    memset (ring, 0, sizeof (*ring));
+    ring->sock = -1;
+}
+
+static inline void
+free_ring (fence_kdump_ring_t *ring)
+{
+    if (ring->map != NULL) {
+        munmap (ring->map, ring->size);
+    }
+    if (ring->sock >= 0) {
+        close (ring->sock);
+    }
+
+    init_ring (ring);
+}
+
+/*
+ * Passes only UDP to the port that was received (not sent) by this
+ * host, unfragmented and with no IPv6 extension headers. A packet
+ * socket of type SOCK_DGRAM sees the packet from the network header.
+ */
+static inline void
+build_ring_filter (fence_kdump_filter_t *filter, int port)
+{
+    filter->len = 0;
+
+    add_filter (filter, BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_PKTTYPE);
+    add_filter (filter, BPF_JMP | BPF_JEQ | BPF_K, 16, 0, PACKET_OUTGOING);
+    add_filter (filter, BPF_LD | BPF_B | BPF_ABS, 0, 0, 0);
+    add_filter (filter, BPF_ALU | BPF_RSH | BPF_K, 0, 0, 4);
+    add_filter (filter, BPF_JMP | BPF_JEQ | BPF_K, 0, 7, 4);
+
+    /* IPv4: protocol, fragment offset and more fragments, then port */
+    add_filter (filter, BPF_LD | BPF_B | BPF_ABS, 0, 0, 9);
+    add_filter (filter, BPF_JMP | BPF_JEQ | BPF_K, 0, 11, FENCE_KDUMP_UDP_PROTO);
+    add_filter (filter, BPF_LD | BPF_H | BPF_ABS, 0, 0, 6);
+    add_filter (filter, BPF_JMP | BPF_JSET | BPF_K, 9, 0, 0x3FFF);
+    add_filter (filter, BPF_LDX | BPF_B | BPF_MSH, 0, 0, 0);
+    add_filter (filter, BPF_LD | BPF_H | BPF_IND, 0, 0, 2);
+    add_filter (filter, BPF_JMP | BPF_JEQ | BPF_K, 5, 6, port);
+
+    /* IPv6: next header, then port */
+    add_filter (filter, BPF_JMP | BPF_JEQ | BPF_K, 0, 5, 6);
+    add_filter (filter, BPF_LD | BPF_B | BPF_ABS, 0, 0, 6);
+    add_filter (filter, BPF_JMP | BPF_JEQ | BPF_K, 0, 3, FENCE_KDUMP_UDP_PROTO);
+    add_filter (filter, BPF_LD | BPF_H | BPF_ABS, 0, 0, FENCE_KDUMP_IPV6_HLEN + 2);
+    add_filter (filter, BPF_JMP | BPF_JEQ | BPF_K, 0, 1, port);
+
+    add_filter (filter, BPF_RET | BPF_K, 0, 0, FENCE_KDUMP_RING_SNAPLEN);
+    add_filter (filter, BPF_RET | BPF_K, 0, 0, FENCE_KDUMP_FILTER_REJECT);
+}
+
+/*
+ * Captures on one interface, or all of them with an ifindex of 0. The
+ * filter is attached before the socket is bound, so nothing else ever
+ * reaches the ring.
+ */
+static inline int
+open_ring (fence_kdump_ring_t *ring, unsigned int ifindex, int port)
+{
+    int version = TPACKET_V3;
+    struct tpacket_req3 req;
+    struct sockaddr_ll sll;
+    fence_kdump_filter_t filter;
+
+    init_ring (ring);
+
+    ring->sock = socket (AF_PACKET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (ring->sock < 0) {
+        return (-1);
+    }
+
+    build_ring_filter (&filter, port);
+
+    memset (&req, 0, sizeof (req));
+    req.tp_block_size = FENCE_KDUMP_RING_BLOCK_SIZE;
+    req.tp_block_nr = FENCE_KDUMP_RING_BLOCKS;
+    req.tp_frame_size = FENCE_KDUMP_RING_FRAME_SIZE;
+    req.tp_frame_nr = (req.tp_block_size / req.tp_frame_size) * req.tp_block_nr;
+    req.tp_retire_blk_tov = FENCE_KDUMP_RING_TIMEOUT;
+
+    if ((attach_filter (ring->sock, &filter) != 0) ||
+        (setsockopt (ring->sock, SOL_PACKET, PACKET_VERSION, &version, sizeof (version)) != 0) ||
+        (setsockopt (ring->sock, SOL_PACKET, PACKET_RX_RING, &req, sizeof (req)) != 0)) {
+        free_ring (ring);
+        return (-1);
+    }
+
+    ring->size = (size_t) req.tp_block_size * req.tp_block_nr;
+    ring->map = mmap (NULL, ring->size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_LOCKED, ring->sock, 0);
+    if (ring->map == MAP_FAILED) {
+        /* locking the ring in memory is only a nicety */
+        ring->map = mmap (NULL, ring->size, PROT_READ | PROT_WRITE,
+                          MAP_SHARED, ring->sock, 0);
+    }
+    if (ring->map == MAP_FAILED) {
+        ring->map = NULL;
+        free_ring (ring);
+        return (-1);
+    }
+
+    memset (&sll, 0, sizeof (sll));
+    sll.sll_family = AF_PACKET;
+    sll.sll_protocol = htons (ETH_P_ALL);
+    sll.sll_ifindex = ifindex;
+
+    if (bind (ring->sock, (struct sockaddr *) &sll, sizeof (sll)) != 0) {
+        free_ring (ring);
+        return (-1);
+    }
+
+    return (0);
+}
+
+static inline struct tpacket_block_desc *
+get_ring_block (const fence_kdump_ring_t *ring, unsigned int block)
+{
+    return ((struct tpacket_block_desc *) (ring->map + (size_t) block * FENCE_KDUMP_RING_BLOCK_SIZE));
+}
+
+/*
+ * Finds the UDP payload of a packet the filter passed. Returns -1 for
+ * a packet too short to be one, which the filter should not have let
+ * through.
+ */
+static inline int
+parse_datagram (const uint8_t *pkt, size_t snaplen, fence_kdump_datagram_t *dgram)
+{
+    size_t hlen;
+    size_t ulen;
+    struct sockaddr_in *sin = (struct sockaddr_in *) &dgram->from;
+    struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *) &dgram->from;
+
+    memset (&dgram->from, 0, sizeof (dgram->from));
+
+    if ((snaplen >= FENCE_KDUMP_IPV4_HLEN) && ((pkt[0] >> 4) == 4)) {
+        hlen = (size_t) (pkt[0] & 0xF) * 4;
+        sin->sin_family = AF_INET;
+        memcpy (&sin->sin_addr, pkt + 12, sizeof (sin->sin_addr));
+    } else if ((snaplen >= FENCE_KDUMP_IPV6_HLEN) && ((pkt[0] >> 4) == 6)) {
+        hlen = FENCE_KDUMP_IPV6_HLEN;
+        sin6->sin6_family = AF_INET6;
+        memcpy (&sin6->sin6_addr, pkt + 8, sizeof (sin6->sin6_addr));
+    } else {
+        return (-1);
+    }
+
+    if (snaplen < hlen + FENCE_KDUMP_UDP_HLEN) {
+        return (-1);
+    }
+
+    /* the source port sits at the same offset in both address types */
+    memcpy (&sin->sin_port, pkt + hlen, sizeof (sin->sin_port));
+
+    ulen = ((size_t) pkt[hlen + 4] << 8) | pkt[hlen + 5];
+    ulen = (ulen > FENCE_KDUMP_UDP_HLEN) ? ulen - FENCE_KDUMP_UDP_HLEN : 0;
+
+    dgram->data = pkt + hlen + FENCE_KDUMP_UDP_HLEN;
+    dgram->len = snaplen - hlen - FENCE_KDUMP_UDP_HLEN;
+    dgram->truncated = (ulen > dgram->len);
+    if (ulen < dgram->len) {
+        dgram->len = ulen;
+    }
+
+    return (0);
+}
+
+/*
+ * Takes the next datagram from the ring. A block is given back to the
+ * kernel once every packet in it was taken. Returns 0 when no block is
+ * left to read.
+ */
+static inline int
+next_datagram (fence_kdump_ring_t *ring, fence_kdump_datagram_t *dgram)
+{
+    struct tpacket_block_desc *desc;
+    struct tpacket3_hdr *hdr;
+
+    for (;;) {
+        desc = get_ring_block (ring, ring->block);
+
+        if (ring->next == NULL) {
+            if ((__atomic_load_n (&desc->hdr.bh1.block_status, __ATOMIC_ACQUIRE) &
+                 TP_STATUS_USER) == 0) {
+                return (0);
+            }
+            ring->left = desc->hdr.bh1.num_pkts;
+            ring->next = (struct tpacket3_hdr *) ((uint8_t *) desc +
+                                                  desc->hdr.bh1.offset_to_first_pkt);
+        }
+
+        if (ring->left == 0) {
+            __atomic_store_n (&desc->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+            ring->block = (ring->block + 1) % FENCE_KDUMP_RING_BLOCKS;
+            ring->next = NULL;
+            continue;
+        }
+
+        hdr = ring->next;
+        ring->next = (struct tpacket3_hdr *) ((uint8_t *) hdr + hdr->tp_next_offset);
+        ring->left--;
+
+        if (parse_datagram ((const uint8_t *) hdr + hdr->tp_net, hdr->tp_snaplen, dgram) == 0) {
+            dgram->rx.tv_sec = hdr->tp_sec;
+            dgram->rx.tv_nsec = hdr->tp_nsec;
+            return (1);
+        }
+    }
+}
+
+#endif /* _FENCE_KDUMP_PACKET_H */
@@ -0,0 +1,148 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*-
+ *
+ * Copyright (c) Ryan O'Hara (rohara@redhat.com)
+ * Copyright (c) Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef _FENCE_KDUMP_PEERS_H
+#define _FENCE_KDUMP_PEERS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <sys/socket.h>
+
+/*
+ * Peer file of fence_kdump_send: one node per line,
+ *
+ *   NODE [PORT] [FAMILY]
+ *
+ * where PORT and FAMILY ("auto", "ipv4" or "ipv6") override the
+ * command line for that node only. Empty lines and anything after a
+ * '#' are ignored.
+ */
+/* size of the peer file read by the static build */
+#define FENCE_KDUMP_PEER_FILE_LEN 8192
+
+typedef struct fence_kdump_peer {
+    const char *name;
+    int family;
+    int port;
+} fence_kdump_peer_t;
+
+/* Returns 0 for a peer, 1 for a line without one and -1 if invalid. */
+static inline int
+parse_peer (fence_kdump_peer_t *peer, char *line, int family, int port)
+{
+    char *save;
+    char *word;
+
+    line[strcspn (line, "#")] = 0;
+
+    peer->name = strtok_r (line, " \t\r\n", &save);
+    if (peer->name == NULL) {
+        return (1);
+    }
+
+    peer->family = family;
+    peer->port = port;
+
+    while ((word = strtok_r (NULL, " \t\r\n", &save)) != NULL) {
+        if (isdigit ((unsigned char) word[0])) {
+            peer->port = atoi (word);
+            if ((peer->port < 1) || (peer->port > 65535)) {
+                return (-1);
+            }
+        } else if (!strcasecmp (word, "auto")) {
+            peer->family = AF_UNSPEC;
+        } else if (!strcasecmp (word, "ipv4")) {
+            peer->family = AF_INET;
+        } else if (!strcasecmp (word, "ipv6")) {
+            peer->family = AF_INET6;
+        } else {
+            return (-1);
+        }
+    }
+
+    return (0);
+}
+
+/*
+ * Reads the file into buf, which must hold len bytes, and splits it
+ * into at most max peers whose names point into buf. A line holds at
+ * most one peer and takes at least two bytes, so len / 2 + 1 peers are
+ * always enough. Invalid lines are counted in *bad and skipped.
+ * Returns the number of peers, or -1 if the file cannot be read or
+ * does not fit in buf (with errno set to EFBIG), rather than use a
+ * part of it.
+ */
+static inline int
+read_peer_file (const char *path, char *buf, size_t len, fence_kdump_peer_t *peer,
+                int max, int family, int port, int *bad)
+{
+    int n = 0;
+    FILE *fp;
+    char *line;
+    char *next;
+    size_t size;
+
+    *bad = 0;
+
+    if ((fp = fopen (path, "re")) == NULL) {
+        return (-1);
+    }
+
+    size = fread (buf, 1, len - 1, fp);
+    buf[size] = 0;
+
+    if (ferror (fp)) {
+        fclose (fp);
+        return (-1);
+    }
+
+    if ((size == len - 1) && (fgetc (fp) != EOF)) {
+        fclose (fp);
+        errno = EFBIG;
+        return (-1);
+    }
+
+    fclose (fp);
+
+    for (line = buf; (line != NULL) && (n < max); line = next) {
+        next = strchr (line, '\n');
+        if (next != NULL) {
+            *next++ = 0;
+        }
+        switch (parse_peer (&peer[n], line, family, port)) {
+        case 0:
+            n++;
+            break;
+        case -1:
+            (*bad)++;
+            break;
+        default:
+            break;
+        }
+    }
+
+    return (n);
+}
+
+#endif /* _FENCE_KDUMP_PEERS_H */
@@ -0,0 +1,356 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*-
+ *
+ * Copyright (c) Ryan O'Hara (rohara@redhat.com)
+ * Copyright (c) Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef _FENCE_KDUMP_RESOLVE_H
+#define _FENCE_KDUMP_RESOLVE_H
+
+#include <stdio.h>
+#include <netdb.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "addr.h"
+
+#define FENCE_KDUMP_MAX_ADDRS 8
+#define FENCE_KDUMP_CACHE_LINE 1024
+
+#define FENCE_KDUMP_DEFAULT_RESOLVE_TIMEOUT 2000
+
+/* where the addresses of a name came from */
+enum {
+    FENCE_KDUMP_RESOLVE_NONE    = 0,
+    FENCE_KDUMP_RESOLVE_NUMERIC = 1,
+    FENCE_KDUMP_RESOLVE_DNS     = 2,
+    FENCE_KDUMP_RESOLVE_CACHE   = 3,
+};
+
+/*
+ * One name to resolve, with the family and port it is wanted for, and
+ * the addresses it resolved to with the port already filled in. The
+ * request block is used by getaddrinfo_a() and must stay in place
+ * until the lookup has completed or been cancelled.
+ */
+typedef struct fence_kdump_resolve {
+    const char *name;
+    int family;
+    int port;
+    int source;
+    int count;
+    struct sockaddr_storage addr[FENCE_KDUMP_MAX_ADDRS];
+#ifndef FENCE_KDUMP_STATIC
+    int pending;
+    char service[8];
+    struct addrinfo hints;
+    struct gaicb cb;
+#endif
+} fence_kdump_resolve_t;
+
+static inline socklen_t
+get_addrlen (const struct sockaddr_storage *ss)
+{
+    return ((ss->ss_family == AF_INET6) ?
+            sizeof (struct sockaddr_in6) : sizeof (struct sockaddr_in));
+}
+
+static inline void
+add_resolve_addr (fence_kdump_resolve_t *res, const struct sockaddr *sa, socklen_t len)
+{
+    if ((res->count < FENCE_KDUMP_MAX_ADDRS) && (len <= sizeof (res->addr[0]))) {
+        memset (&res->addr[res->count], 0, sizeof (res->addr[0]));
+        memcpy (&res->addr[res->count], sa, len);
+        res->count++;
+    }
+}
+
+/*
+ * Parse a numeric address into the next slot. This never touches the
+ * resolver, so it is also used for the static sender and the cache.
+ */
+static inline int
+add_resolve_numeric (fence_kdump_resolve_t *res, const char *str, int family, int port)
+{
+    struct sockaddr_storage ss;
+    struct sockaddr_in *sin = (struct sockaddr_in *) &ss;
+    struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *) &ss;
+
+    memset (&ss, 0, sizeof (ss));
+
+    if ((family != AF_INET6) && (inet_pton (AF_INET, str, &sin->sin_addr) == 1)) {
+        sin->sin_family = AF_INET;
+        sin->sin_port = htons (port);
+    } else if ((family != AF_INET) && (inet_pton (AF_INET6, str, &sin6->sin6_addr) == 1)) {
+        sin6->sin6_family = AF_INET6;
+        sin6->sin6_port = htons (port);
+    } else {
+        return (-1);
+    }
+
+    add_resolve_addr (res, (struct sockaddr *) &ss, get_addrlen (&ss));
+
+    return (0);
+}
+
+static inline void
+init_resolve (fence_kdump_resolve_t *res, const char *name, int family, int port)
+{
+    memset (res, 0, sizeof (*res));
+    res->name = name;
+    res->family = family;
+    res->port = port;
+}
+
+/* Fill unresolved names from the cache file, "NAME ADDR [ADDR]..." per line. */
+static inline void
+read_resolve_cache (fence_kdump_resolve_t *res, int n, const char *path)
+{
+    int i;
+    FILE *fp;
+    char *name;
+    char *word;
+    char *save;
+    char line[FENCE_KDUMP_CACHE_LINE];
+
+    if ((path == NULL) || ((fp = fopen (path, "re")) == NULL)) {
+        return;
+    }
+
+    while (fgets (line, sizeof (line), fp) != NULL) {
+        name = strtok_r (line, " \t\n", &save);
+        if ((name == NULL) || (name[0] == '#')) {
+            continue;
+        }
+        for (i = 0; i < n; i++) {
+            if ((res[i].source != FENCE_KDUMP_RESOLVE_NONE) ||
+                (strcasecmp (res[i].name, name) != 0)) {
+                continue;
+            }
+            while ((word = strtok_r (NULL, " \t\n", &save)) != NULL) {
+                add_resolve_numeric (&res[i], word, res[i].family, res[i].port);
+            }
+            if (res[i].count > 0) {
+                res[i].source = FENCE_KDUMP_RESOLVE_CACHE;
+            }
+            break;
+        }
+    }
+
+    fclose (fp);
+}
+
+/*
+ * Store the names that were just looked up in the cache file. Lines
+ * for other names are kept, and the file is replaced atomically so a
+ * concurrent reader sees either the old or the new cache.
+ */
+static inline int
+write_resolve_cache (const fence_kdump_resolve_t *res, int n, const char *path)
+{
+    int i;
+    int j;
+    int fd;
+    int keep;
+    FILE *in;
+    FILE *out;
+    char *name;
+    char tmp[FENCE_KDUMP_CACHE_LINE];
+    char line[FENCE_KDUMP_CACHE_LINE];
+    char copy[FENCE_KDUMP_CACHE_LINE];
+    char buf[INET6_ADDRSTRLEN];
+    fence_kdump_addr_t key;
+
+    for (i = 0; i < n; i++) {
+        if (res[i].source == FENCE_KDUMP_RESOLVE_DNS) {
+            break;
+        }
+    }
+
+    if ((path == NULL) || (i == n)) {
+        return (0);
+    }
+
+    snprintf (tmp, sizeof (tmp), "%s.XXXXXX", path);
+
+    fd = mkstemp (tmp);
+    if (fd < 0) {
+        return (-1);
+    }
+
+    fchmod (fd, 0644);
+
+    out = fdopen (fd, "w");
+    if (out == NULL) {
+        close (fd);
+        unlink (tmp);
+        return (-1);
+    }
+
+    if ((in = fopen (path, "re")) != NULL) {
+        while (fgets (line, sizeof (line), in) != NULL) {
+            strcpy (copy, line);
+            name = strtok (copy, " \t\n");
+            keep = 1;
+            for (j = 0; (name != NULL) && (j < n); j++) {
+                if ((res[j].source == FENCE_KDUMP_RESOLVE_DNS) &&
+                    (strcasecmp (res[j].name, name) == 0)) {
+                    keep = 0;
+                }
+            }
+            if (keep) {
+                fputs (line, out);
+            }
+        }
+        fclose (in);
+    }
+
+    for (i = 0; i < n; i++) {
+        if (res[i].source != FENCE_KDUMP_RESOLVE_DNS) {
+            continue;
+        }
+        fprintf (out, "%s", res[i].name);
+        for (j = 0; j < res[i].count; j++) {
+            set_addr (&key, (const struct sockaddr *) &res[i].addr[j]);
+            fprintf (out, " %s", print_addr (&key, buf, sizeof (buf)));
+        }
+        fprintf (out, "\n");
+    }
+
+    if ((fclose (out) != 0) || (rename (tmp, path) != 0)) {
+        unlink (tmp);
+        return (-1);
+    }
+
+    return (0);
+}
+
+#ifndef FENCE_KDUMP_STATIC
+
+/*
+ * Look up every name that is not an address, all at once, and wait for
+ * the answers no longer than timeout milliseconds. Lookups still
+ * running at the deadline are cancelled. If a lookup cannot be
+ * cancelled, the resolver may still write to its request block, and
+ * the function returns 1 to tell the caller not to free the array.
+ */
+static inline int
+resolve_names (fence_kdump_resolve_t *res, int n, long timeout)
+{
+    int i;
+    int error;
+    int pending = 0;
+    int busy = 0;
+    long left;
+    struct addrinfo *info;
+    struct timespec now;
+    struct timespec end;
+    struct timespec wait;
+    const struct gaicb *list[n];
+    struct gaicb *cb[1];
+
+    for (i = 0; i < n; i++) {
+        list[i] = NULL;
+
+        if (add_resolve_numeric (&res[i], res[i].name, res[i].family, res[i].port) == 0) {
+            res[i].source = FENCE_KDUMP_RESOLVE_NUMERIC;
+            continue;
+        }
+
+        snprintf (res[i].service, sizeof (res[i].service), "%d", res[i].port);
+
+        res[i].hints.ai_family = res[i].family;
+        res[i].hints.ai_socktype = SOCK_DGRAM;
+        res[i].hints.ai_protocol = IPPROTO_UDP;
+        res[i].hints.ai_flags = AI_NUMERICSERV;
+
+        res[i].cb.ar_name = res[i].name;
+        res[i].cb.ar_service = res[i].service;
+        res[i].cb.ar_request = &res[i].hints;
+
+        cb[0] = &res[i].cb;
+        if (getaddrinfo_a (GAI_NOWAIT, cb, 1, NULL) == 0) {
+            res[i].pending = 1;
+            list[i] = &res[i].cb;
+            pending++;
+        }
+    }
+
+    clock_gettime (CLOCK_MONOTONIC, &end);
+    end.tv_sec += timeout / 1000;
+    end.tv_nsec += (timeout % 1000) * 1000000L;
+    if (end.tv_nsec >= 1000000000L) {
+        end.tv_sec++;
+        end.tv_nsec -= 1000000000L;
+    }
+
+    while (pending > 0) {
+        clock_gettime (CLOCK_MONOTONIC, &now);
+        left = (end.tv_sec - now.tv_sec) * 1000L + (end.tv_nsec - now.tv_nsec) / 1000000L;
+        if (left <= 0) {
+            break;
+        }
+
+        wait.tv_sec = left / 1000;
+        wait.tv_nsec = (left % 1000) * 1000000L;
+        gai_suspend (list, n, &wait);
+
+        for (i = 0; i < n; i++) {
+            if ((list[i] == NULL) || (gai_error (&res[i].cb) == EAI_INPROGRESS)) {
+                continue;
+            }
+            list[i] = NULL;
+            res[i].pending = 0;
+            pending--;
+        }
+    }
+
+    for (i = 0; i < n; i++) {
+        if (res[i].cb.ar_name == NULL) {
+            continue;
+        }
+        if (res[i].pending != 0) {
+            error = gai_cancel (&res[i].cb);
+            if (error == EAI_NOTCANCELED) {
+                busy = 1;
+            }
+            if (error != EAI_ALLDONE) {
+                continue;
+            }
+        }
+        if (gai_error (&res[i].cb) != 0) {
+            continue;
+        }
+        for (info = res[i].cb.ar_result; info != NULL; info = info->ai_next) {
+            add_resolve_addr (&res[i], info->ai_addr, info->ai_addrlen);
+        }
+        freeaddrinfo (res[i].cb.ar_result);
+        res[i].cb.ar_result = NULL;
+        if (res[i].count > 0) {
+            res[i].source = FENCE_KDUMP_RESOLVE_DNS;
+        }
+    }
+
+    return (busy);
+}
+
+#endif
+
+#endif /* _FENCE_KDUMP_RESOLVE_H */
@@ -0,0 +1,126 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*-
+ *
+ * Copyright (c) Ryan O'Hara (rohara@redhat.com)
+ * Copyright (c) Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef _FENCE_KDUMP_SCHEDULE_H
+#define _FENCE_KDUMP_SCHEDULE_H
+
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+
+/*
+ * Send schedule: a burst of messages a short, fixed time apart, then
+ * an exponential backoff from twice that time up to the interval. Each
+ * backoff delay is shortened by a random amount of up to a quarter, so
+ * that nodes which crashed together drift apart. Times are kept as
+ * absolute CLOCK_MONOTONIC deadlines, so time spent sending does not
+ * add up across rounds.
+ */
+typedef struct fence_kdump_schedule {
+    int burst;
+    long burst_interval;
+    long interval;
+    long delay;
+    int sent;
+    unsigned int seed;
+    struct timespec next;
+} fence_kdump_schedule_t;
+
+static inline void
+init_schedule (fence_kdump_schedule_t *sched, int burst, long burst_interval,
+               long interval, unsigned int seed)
+{
+    sched->burst = burst;
+    sched->burst_interval = burst_interval;
+    sched->interval = interval;
+    sched->delay = burst_interval;
+    sched->sent = 0;
+    sched->seed = seed;
+
+    clock_gettime (CLOCK_MONOTONIC, &sched->next);
+}
+
+/* Returns the delay in milliseconds before the next message. */
+static inline long
+next_schedule (fence_kdump_schedule_t *sched)
+{
+    long delay;
+
+    if (++sched->sent < sched->burst) {
+        delay = sched->burst_interval;
+    } else {
+        sched->delay *= 2;
+        if ((sched->delay > sched->interval) || (sched->delay <= 0)) {
+            sched->delay = sched->interval;
+        }
+        delay = sched->delay - (rand_r (&sched->seed) % (sched->delay / 4 + 1));
+    }
+
+    sched->next.tv_sec += delay / 1000;
+    sched->next.tv_nsec += (delay % 1000) * 1000000L;
+
+    if (sched->next.tv_nsec >= 1000000000L) {
+        sched->next.tv_sec += 1;
+        sched->next.tv_nsec -= 1000000000L;
+    }
+
+    return (delay);
+}
+
+/*
+ * Waits for the next message, or until one of the descriptors becomes
+ * readable, in which case 1 is returned and the caller is expected to
+ * wait again.
+ */
+static inline int
+wait_schedule (const fence_kdump_schedule_t *sched, struct pollfd *fds, int nfds)
+{
+    struct timespec now;
+    struct timespec left;
+
+    for (;;) {
+        clock_gettime (CLOCK_MONOTONIC, &now);
+
+        left.tv_sec = sched->next.tv_sec - now.tv_sec;
+        left.tv_nsec = sched->next.tv_nsec - now.tv_nsec;
+        if (left.tv_nsec < 0) {
+            left.tv_sec -= 1;
+            left.tv_nsec += 1000000000L;
+        }
+        if (left.tv_sec < 0) {
+            return (0);
+        }
+
+        switch (ppoll (fds, nfds, &left, NULL)) {
+        case 0:
+            return (0);
+        case -1:
+            if (errno != EINTR) {
+                return (0);
+            }
+            break;
+        default:
+            return (1);
+        }
+    }
+}
+
+#endif /* _FENCE_KDUMP_SCHEDULE_H */
@@ -0,0 +1,263 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*-
+ *
+ * Copyright (c) Ryan O'Hara (rohara@redhat.com)
+ * Copyright (c) Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef _FENCE_KDUMP_SEEN_H
+#define _FENCE_KDUMP_SEEN_H
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "addr.h"
+#include "message.h"
+
+#define FENCE_KDUMP_SEEN_LINE 256
+
+/* the daemon writes the table at most this often (seconds) */
+#define FENCE_KDUMP_SEEN_INTERVAL 1
+
+/*
+ * Last-seen table, kept in a file so that "status" can be answered
+ * without listening. One line per sender address:
+ *
+ *   ADDR SECONDS.NANOSECONDS STAGE WRITTEN TOTAL NODE [BOOT_ID SEQ]
+ *
+ * The time is when the last valid message was received. NODE is the
+ * identity carried by version 2 messages, or "-" for version 1. For
+ * version 2, BOOT_ID (hex) and SEQ are those of the last message
+ * accepted, so that a message cannot be replayed to a later run.
+ * Tables written without them are still read.
+ */
+typedef struct fence_kdump_seen {
+    fence_kdump_addr_t addr;
+    char node[FENCE_KDUMP_NODE_ID_LEN + 1];
+    struct timespec last;
+    fence_kdump_progress_t progress;
+    uint8_t boot_id[FENCE_KDUMP_BOOT_ID_LEN];
+    uint64_t seq;
+} fence_kdump_seen_t;
+
+static inline int
+parse_boot_id (uint8_t *boot_id, const char *word)
+{
+    unsigned int i;
+    uint8_t tmp[FENCE_KDUMP_BOOT_ID_LEN];
+
+    if (strlen (word) != sizeof (tmp) * 2) {
+        return (-1);
+    }
+
+    for (i = 0; i < sizeof (tmp); i++) {
+        if (sscanf (&word[i * 2], "%2hhx", &tmp[i]) != 1) {
+            return (-1);
+        }
+    }
+
+    memcpy (boot_id, tmp, sizeof (tmp));
+
+    return (0);
+}
+
+static inline int
+parse_seen (fence_kdump_seen_t *seen, char *line)
+{
+    int stage;
+    char *save;
+    char *word[8];
+    long long sec;
+    long nsec;
+    unsigned int i;
+
+    for (i = 0; i < 6; i++) {
+        word[i] = strtok_r ((i == 0) ? line : NULL, " \t\n", &save);
+        if (word[i] == NULL) {
+            return (-1);
+        }
+    }
+
+    if ((parse_addr (&seen->addr, word[0]) != 0) ||
+        (sscanf (word[1], "%lld.%ld", &sec, &nsec) != 2) ||
+        ((stage = parse_stage (word[2])) < 0)) {
+        return (-1);
+    }
+
+    seen->last.tv_sec = sec;
+    seen->last.tv_nsec = nsec;
+    seen->progress.stage = stage;
+    seen->progress.written = strtoull (word[3], NULL, 10);
+    seen->progress.total = strtoull (word[4], NULL, 10);
+
+    if (strcmp (word[5], "-") == 0) {
+        seen->node[0] = 0;
+    } else {
+        snprintf (seen->node, sizeof (seen->node), "%s", word[5]);
+    }
+
+    memset (seen->boot_id, 0, sizeof (seen->boot_id));
+    seen->seq = 0;
+
+    word[6] = strtok_r (NULL, " \t\n", &save);
+    word[7] = strtok_r (NULL, " \t\n", &save);
+
+    /* a table without them only loses the replay state */
+    if ((word[6] != NULL) && (word[7] != NULL) &&
+        (parse_boot_id (seen->boot_id, word[6]) == 0)) {
+        seen->seq = strtoull (word[7], NULL, 10);
+    }
+
+    return (0);
+}
+
+static inline void
+print_seen (FILE *out, const fence_kdump_seen_t *seen)
+{
+    unsigned int i;
+    char node[FENCE_KDUMP_NODE_ID_LEN + 1];
+    char buf[INET6_ADDRSTRLEN];
+
+    /* the identity comes off the wire, keep the line parseable */
+    for (i = 0; seen->node[i] != 0; i++) {
+        node[i] = ((seen->node[i] > ' ') && (seen->node[i] < 0x7f)) ? seen->node[i] : '_';
+    }
+    node[i] = 0;
+
+    fprintf (out, "%s %lld.%09ld %s %llu %llu %s",
+             print_addr (&seen->addr, buf, sizeof (buf)),
+             (long long) seen->last.tv_sec, seen->last.tv_nsec,
+             stage_name (seen->progress.stage),
+             (unsigned long long) seen->progress.written,
+             (unsigned long long) seen->progress.total,
+             (node[0] != 0) ? node : "-");
+
+    if (seen->node[0] != 0) {
+        for (i = 0; i < FENCE_KDUMP_BOOT_ID_LEN; i++) {
+            fprintf (out, "%s%02x", (i == 0) ? " " : "", seen->boot_id[i]);
+        }
+        fprintf (out, " %llu", (unsigned long long) seen->seq);
+    }
+
+    fprintf (out, "\n");
+}
+
+/*
+ * Reads up to max records. Returns the number read, or -1 if the file
+ * cannot be opened. Lines that do not parse are skipped.
+ */
+static inline int
+read_seen_file (const char *path, fence_kdump_seen_t *seen, int max)
+{
+    int n = 0;
+    FILE *in;
+    char line[FENCE_KDUMP_SEEN_LINE];
+
+    in = fopen (path, "re");
+    if (in == NULL) {
+        return (-1);
+    }
+
+    while ((n < max) && (fgets (line, sizeof (line), in) != NULL)) {
+        if ((line[0] != '#') && (parse_seen (&seen[n], line) == 0)) {
+            n++;
+        }
+    }
+
+    fclose (in);
+
+    return (n);
+}
+
+/* replaces the file as a whole, so a reader never sees half of it */
+static inline int
+write_seen_file (const char *path, const fence_kdump_seen_t *seen, int n)
+{
+    int i;
+    int fd;
+    FILE *out;
+    char tmp[PATH_MAX];
+
+    if (snprintf (tmp, sizeof (tmp), "%s.XXXXXX", path) >= (int) sizeof (tmp)) {
+        return (-1);
+    }
+
+    fd = mkstemp (tmp);
+    if (fd < 0) {
+        return (-1);
+    }
+
+    fchmod (fd, 0644);
+
+    out = fdopen (fd, "w");
+    if (out == NULL) {
+        close (fd);
+        unlink (tmp);
+        return (-1);
+    }
+
+    fprintf (out, "# fence_kdump last-seen table\n");
+
+    for (i = 0; i < n; i++) {
+        print_seen (out, &seen[i]);
+    }
+
+    if ((fclose (out) != 0) || (rename (tmp, path) != 0)) {
+        unlink (tmp);
+        return (-1);
+    }
+
+    return (0);
+}
+
+/*
+ * Adds a record to a table of n, replacing the one for the same
+ * address or, when the table is full, the one seen least recently.
+ * Returns the new number of records.
+ */
+static inline int
+merge_seen (fence_kdump_seen_t *seen, int n, int max, const fence_kdump_seen_t *add)
+{
+    int i;
+    int old = 0;
+
+    for (i = 0; i < n; i++) {
+        if (memcmp (&seen[i].addr, &add->addr, sizeof (add->addr)) == 0) {
+            seen[i] = *add;
+            return (n);
+        }
+        if (seen[i].last.tv_sec < seen[old].last.tv_sec) {
+            old = i;
+        }
+    }
+
+    if (n < max) {
+        seen[n++] = *add;
+    } else if (n > 0) {
+        seen[old] = *add;
+    }
+
+    return (n);
+}
+
+#endif /* _FENCE_KDUMP_SEEN_H */
@@ -0,0 +1,424 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*-
+ *
+ * Copyright (c) Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef _FENCE_OPTS_H
+#define _FENCE_OPTS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <getopt.h>
+#include <unistd.h>
+
+/*
+ * Option table shared by the C agents. Each option is described once;
+ * command line parsing, the key=value options read on stdin, the usage
+ * text and the XML metadata are all derived from the table. Values are
+ * handed to a setter of the agent, keyed by the short option.
+ */
+
+#define FENCE_OPTS_MAX       32
+#define FENCE_OPTS_HASH_SIZE 64
+#define FENCE_OPTS_LINE_LEN  1024
+#define FENCE_OPTS_BUF_LEN   16384
+
+/* for numeric defaults given as macros */
+#define FENCE_OPTS_STR(x)    FENCE_OPTS_STR_(x)
+#define FENCE_OPTS_STR_(x)   #x
+
+/* usage column at which descriptions start */
+#define FENCE_OPTS_USAGE_COL 29
+
+#define FENCE_OPT_NO_STDIN    0x1
+#define FENCE_OPT_NO_METADATA 0x2
+#define FENCE_OPT_UNIQUE      0x4
+#define FENCE_OPT_REQUIRED    0x8
+
+typedef struct fence_opt {
+    int id;                  /* short option, passed to the setter */
+    const char *longopt;
+    int has_arg;             /* as for getopt_long() */
+    const char *name;        /* metadata parameter and stdin key */
+    const char *key;         /* stdin key, if not the name */
+    const char *argname;     /* usage: --longopt=ARGNAME */
+    const char *content;     /* metadata content type */
+    const char *def;         /* metadata default, if any */
+    const char *mixed;       /* metadata getopt, if not "-x, --longopt" */
+    const char *shortdesc;   /* metadata description */
+    const char *help;        /* usage description */
+    int flags;
+} fence_opt_t;
+
+/*
+ * Returns 0 to go on, anything else stops parsing and is returned to
+ * the caller (e.g. for --help).
+ */
+typedef int (*fence_opts_set_t) (void *ctx, int id, const char *arg);
+
+typedef struct fence_opts {
+    const char *name;        /* agent name, or NULL for the program name */
+    const char *shortdesc;
+    const char *longdesc;
+    const char *vendor_url;  /* may be NULL */
+    const char *const *actions;
+    const fence_opt_t *opt;  /* ends with an entry whose id is 0 */
+    fence_opts_set_t set;
+
+    /* derived from the table on first use */
+    int ready;
+    char shortopts[3 * FENCE_OPTS_MAX + 1];
+    struct option longopts[FENCE_OPTS_MAX + 1];
+    const fence_opt_t *hash[FENCE_OPTS_HASH_SIZE];
+} fence_opts_t;
+
+static inline const char *
+get_opt_key (const fence_opt_t *opt)
+{
+    return ((opt->key != NULL) ? opt->key : opt->name);
+}
+
+/* FNV-1a over the lower case key, as stdin keys are case insensitive */
+static inline unsigned int
+hash_opt_key (const char *key)
+{
+    unsigned int hash = 2166136261U;
+
+    for (; *key != 0; key++) {
+        hash = (hash ^ (unsigned char) tolower ((unsigned char) *key)) * 16777619U;
+    }
+
+    return (hash & (FENCE_OPTS_HASH_SIZE - 1));
+}
+
+static inline void
+prepare_opts (fence_opts_t *opts)
+{
+    int i;
+    int n = 0;
+    unsigned int h;
+    char *p = opts->shortopts;
+    const fence_opt_t *opt;
+
+    if (opts->ready != 0) {
+        return;
+    }
+
+    for (opt = opts->opt; (opt->id != 0) && (n < FENCE_OPTS_MAX); opt++, n++) {
+        *p++ = opt->id;
+        if (opt->has_arg != no_argument) {
+            *p++ = ':';
+        }
+        if (opt->has_arg == optional_argument) {
+            *p++ = ':';
+        }
+
+        opts->longopts[n].name = opt->longopt;
+        opts->longopts[n].has_arg = opt->has_arg;
+        opts->longopts[n].flag = NULL;
+        opts->longopts[n].val = opt->id;
+
+        if ((opt->flags & FENCE_OPT_NO_STDIN) != 0) {
+            continue;
+        }
+
+        for (i = 0, h = hash_opt_key (get_opt_key (opt));
+             (i < FENCE_OPTS_HASH_SIZE) && (opts->hash[h] != NULL);
+             i++, h = (h + 1) & (FENCE_OPTS_HASH_SIZE - 1));
+        opts->hash[h] = opt;
+    }
+
+    *p = 0;
+    memset (&opts->longopts[n], 0, sizeof (opts->longopts[n]));
+
+    opts->ready = 1;
+}
+
+static inline const fence_opt_t *
+find_opt_key (fence_opts_t *opts, const char *key)
+{
+    int i;
+    unsigned int h;
+
+    prepare_opts (opts);
+
+    for (i = 0, h = hash_opt_key (key);
+         (i < FENCE_OPTS_HASH_SIZE) && (opts->hash[h] != NULL);
+         i++, h = (h + 1) & (FENCE_OPTS_HASH_SIZE - 1)) {
+        if (!strcasecmp (get_opt_key (opts->hash[h]), key)) {
+            return (opts->hash[h]);
+        }
+    }
+
+    return (NULL);
+}
+
+/*
+ * Parses the command line. Returns 0, -1 for an unknown option or a
+ * missing argument, or whatever the setter stopped on.
+ */
+static inline int
+parse_opts_argv (fence_opts_t *opts, int argc, char **argv, void *ctx)
+{
+    int opt;
+    int error;
+
+    prepare_opts (opts);
+
+    while ((opt = getopt_long (argc, argv, opts->shortopts, opts->longopts, NULL)) != EOF) {
+        if ((opt == '?') || (opt == ':')) {
+            return (-1);
+        }
+        error = opts->set (ctx, opt, optarg);
+        if (error != 0) {
+            return (error);
+        }
+    }
+
+    return (0);
+}
+
+static inline char *
+trim_opt (char *str)
+{
+    char *end;
+
+    while (isspace ((unsigned char) *str)) {
+        str++;
+    }
+
+    end = str + strlen (str);
+    while ((end > str) && isspace ((unsigned char) end[-1])) {
+        *--end = 0;
+    }
+
+    return (str);
+}
+
+/*
+ * Parses "key=value" lines as passed by fenced. Blank lines, comments,
+ * unknown keys and empty values are skipped. Returns 0 or whatever the
+ * setter stopped on.
+ */
+static inline int
+parse_opts_stdin (fence_opts_t *opts, FILE *stream, void *ctx)
+{
+    int error;
+    char buf[FENCE_OPTS_LINE_LEN];
+    char *key;
+    char *arg;
+    const fence_opt_t *opt;
+
+    while (fgets (buf, sizeof (buf), stream) != NULL) {
+        key = trim_opt (buf);
+        if ((key[0] == 0) || (key[0] == '#')) {
+            continue;
+        }
+
+        if ((arg = strchr (key, '=')) == NULL) {
+            continue;
+        }
+        *arg++ = 0;
+
+        key = trim_opt (key);
+        arg = trim_opt (arg);
+        if (arg[0] == 0) {
+            continue;
+        }
+
+        opt = find_opt_key (opts, key);
+        if (opt == NULL) {
+            continue;
+        }
+
+        error = opts->set (ctx, opt->id, arg);
+        if (error != 0) {
+            return (error);
+        }
+    }
+
+    return (0);
+}
+
+static inline void
+append_opts_buf (char *buf, size_t size, size_t *len, const char *fmt, ...)
+    __attribute__ ((format (printf, 4, 5)));
+
+static inline void
+append_opts_buf (char *buf, size_t size, size_t *len, const char *fmt, ...)
+{
+    int n;
+    va_list ap;
+
+    if (*len >= size) {
+        return;
+    }
+
+    va_start (ap, fmt);
+    n = vsnprintf (buf + *len, size - *len, fmt, ap);
+    va_end (ap);
+
+    if (n > 0) {
+        *len = ((size_t) n < size - *len) ? (*len + n) : size;
+    }
+}
+
+static inline int
+write_opts_buf (int fd, const char *buf, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0) {
+        n = write (fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return (1);
+        }
+        buf += n;
+        len -= n;
+    }
+
+    return (0);
+}
+
+static inline const char *
+get_opts_name (const fence_opts_t *opts, const char *self)
+{
+    const char *p;
+
+    if (opts->name != NULL) {
+        return (opts->name);
+    }
+
+    p = strrchr (self, '/');
+
+    return ((p != NULL) ? (p + 1) : self);
+}
+
+/*
+ * Writes the XML metadata, built in one buffer and written at once.
+ */
+static inline int
+print_opts_metadata (fence_opts_t *opts, const char *self)
+{
+    size_t len = 0;
+    const fence_opt_t *opt;
+    const char *const *action;
+    static char buf[FENCE_OPTS_BUF_LEN];
+
+    append_opts_buf (buf, sizeof (buf), &len, "<?xml version=\"1.0\" ?>\n");
+    append_opts_buf (buf, sizeof (buf), &len,
+                     "<resource-agent name=\"%s\" shortdesc=\"%s\">\n",
+                     get_opts_name (opts, self), opts->shortdesc);
+    append_opts_buf (buf, sizeof (buf), &len, "<longdesc>%s</longdesc>\n", opts->longdesc);
+    if (opts->vendor_url != NULL) {
+        append_opts_buf (buf, sizeof (buf), &len,
+                         "<vendor-url>%s</vendor-url>\n", opts->vendor_url);
+    }
+
+    append_opts_buf (buf, sizeof (buf), &len, "<parameters>\n");
+
+    for (opt = opts->opt; opt->id != 0; opt++) {
+        if ((opt->flags & FENCE_OPT_NO_METADATA) != 0) {
+            continue;
+        }
+
+        append_opts_buf (buf, sizeof (buf), &len,
+                         "\t<parameter name=\"%s\" unique=\"%d\" required=\"%d\">\n",
+                         opt->name, (opt->flags & FENCE_OPT_UNIQUE) != 0,
+                         (opt->flags & FENCE_OPT_REQUIRED) != 0);
+        if (opt->mixed != NULL) {
+            append_opts_buf (buf, sizeof (buf), &len,
+                             "\t\t<getopt mixed=\"%s\" />\n", opt->mixed);
+        } else {
+            append_opts_buf (buf, sizeof (buf), &len,
+                             "\t\t<getopt mixed=\"-%c, --%s\" />\n", opt->id, opt->longopt);
+        }
+        if (opt->def != NULL) {
+            append_opts_buf (buf, sizeof (buf), &len,
+                             "\t\t<content type=\"%s\" default=\"%s\" />\n",
+                             opt->content, opt->def);
+        } else {
+            append_opts_buf (buf, sizeof (buf), &len,
+                             "\t\t<content type=\"%s\" />\n", opt->content);
+        }
+        append_opts_buf (buf, sizeof (buf), &len,
+                         "\t\t<shortdesc lang=\"en\">%s</shortdesc>\n", opt->shortdesc);
+        append_opts_buf (buf, sizeof (buf), &len, "\t</parameter>\n");
+    }
+
+    append_opts_buf (buf, sizeof (buf), &len, "</parameters>\n");
+
+    append_opts_buf (buf, sizeof (buf), &len, "<actions>\n");
+    for (action = opts->actions; *action != NULL; action++) {
+        append_opts_buf (buf, sizeof (buf), &len, "\t<action name=\"%s\" />\n", *action);
+    }
+    append_opts_buf (buf, sizeof (buf), &len, "</actions>\n");
+
+    append_opts_buf (buf, sizeof (buf), &len, "</resource-agent>\n");
+
+    fflush (stdout);
+
+    return (write_opts_buf (STDOUT_FILENO, buf, len));
+}
+
+/*
+ * Writes the usage text to fd, one line per option in table order.
+ */
+static inline int
+print_opts_usage (fence_opts_t *opts, const char *self, int fd)
+{
+    int n;
+    size_t len = 0;
+    const fence_opt_t *opt;
+    char left[FENCE_OPTS_LINE_LEN];
+    static char buf[FENCE_OPTS_BUF_LEN];
+
+    append_opts_buf (buf, sizeof (buf), &len, "Usage: %s [options]\n",
+                     get_opts_name (opts, self));
+    append_opts_buf (buf, sizeof (buf), &len, "\nOptions:\n\n");
+
+    for (opt = opts->opt; opt->id != 0; opt++) {
+        if (opt->argname != NULL) {
+            n = snprintf (left, sizeof (left), "-%c, --%s=%s",
+                          opt->id, opt->longopt, opt->argname);
+        } else {
+            n = snprintf (left, sizeof (left), "-%c, --%s", opt->id, opt->longopt);
+        }
+        append_opts_buf (buf, sizeof (buf), &len, "  %-*s%s%s\n",
+                         FENCE_OPTS_USAGE_COL, left,
+                         (n >= FENCE_OPTS_USAGE_COL) ? " " : "", opt->help);
+    }
+
+    append_opts_buf (buf, sizeof (buf), &len, "\n");
+
+    if (fd == STDOUT_FILENO) {
+        fflush (stdout);
+    }
+
+    return (write_opts_buf (fd, buf, len));
+}
+
+#endif /* _FENCE_OPTS_H */
@@ -41,31 +41,70 @@
 #include <netiucv/iucv.h>
 #include <arpa/inet.h>
 #include <netdb.h>
-#include <getopt.h>
-#include <ctype.h>
 #include <syslog.h>
+#include "fence_opts.h"
 #include "fence_zvm.h"
 
-#define MIN(a,b)	((a) < (b) ? (a) : (b))
 #define DEFAULT_TIMEOUT 300
 
 static int zvm_smapi_reportError(void *, void *);
 
-static struct option longopts[] = {
-	{"action",	required_argument,	NULL, 'o'},
-	{"help",	no_argument,		NULL, 'h'},
-	{"ipaddr",	required_argument,	NULL, 'a'},
-	{"password",	required_argument,	NULL, 'p'},
-	{"plug",	required_argument,	NULL, 'n'},
-	{"timeout",	required_argument,	NULL, 't'},
-	{"username",	required_argument,	NULL, 'u'},
-	{NULL,		0,			NULL, 0}
+typedef struct {
+	zvm_driver_t	*zvm;
+	int		fence;
+} zvm_options_t;
+
+static int set_option(void *, int, const char *);
+
+static const fence_opt_t options[] = {
+	{ 'n', "plug", required_argument, "port", NULL, "TARGET",
+	  "string", NULL, NULL,
+	  "Name of the Virtual Machine to be fenced",
+	  "Name of virtual machine to fence",
+	  FENCE_OPT_UNIQUE | FENCE_OPT_REQUIRED },
+	{ 'a', "ipaddr", required_argument, "ipaddr", NULL, "SERVER",
+	  "string", NULL, "-i, --ip",
+	  "IP Name or Address of SMAPI Server",
+	  "IP Name/Address of SMAPI Server",
+	  FENCE_OPT_UNIQUE | FENCE_OPT_REQUIRED },
+	{ 'u', "username", required_argument, "login", NULL, "USER",
+	  "string", NULL, NULL,
+	  "Name of authorized SMAPI user\n",
+	  "Name of authorized SMAPI user",
+	  FENCE_OPT_UNIQUE | FENCE_OPT_REQUIRED },
+	{ 'p', "password", required_argument, "passwd", NULL, "PASS",
+	  "string", NULL, NULL,
+	  "Password of authorized SMAPI user\n",
+	  "Password of authorized SMAPI user",
+	  FENCE_OPT_UNIQUE | FENCE_OPT_REQUIRED },
+	{ 'o', "action", required_argument, "action", NULL, "ACTION",
+	  "string", "off", NULL,
+	  "Fencing action",
+	  "\"off\", \"metadata\"",
+	  FENCE_OPT_UNIQUE },
+	{ 't', "timeout", required_argument, "timeout", NULL, "SECS",
+	  "string", NULL, NULL,
+	  "Time to wait for fence in seconds",
+	  "Time to wait for fence in seconds - currently ignored",
+	  FENCE_OPT_NO_METADATA },
+	{ 'h', "help", no_argument, "usage", "help", NULL,
+	  "boolean", NULL, NULL,
+	  "Print usage",
+	  "Display this usage information",
+	  FENCE_OPT_UNIQUE },
+	{ 0 }
 };
 
-static char *optString = "a:o:hn:p:t:u:";
+static const char *const actions[] = { "off", "metadata", NULL };
 
-static int zvm_metadata(void);
-static int usage(void);
+static fence_opts_t options_table = {
+	.name		= "fence_zvmip",
+	.shortdesc	= "Fence agent for use with z/VM Virtual Machines",
+	.longdesc	= "The fence_zvm agent is intended to be used with with z/VM SMAPI service via TCP/IP",
+	.actions	= actions,
+	.opt		= options,
+	.set		= set_option,
+};
 
 /**
  * zvm_smapi_open:
@@ -330,113 +369,59 @@ zvm_smapi_reportError(void *inHdr, void *oHdr)
 
 
 /**
- * trim - Trim spaces from string
- * @str - Pointer to string
- *
- */
-static int
-trim(char *str)
-{
-	char *p;
-	int len;
-
-	if (!str) 
-		return (0);
-
-	len = strlen (str);
-
-	while (len--) {
-		if (isspace (str[len])) {
-			str[len] = 0;
-		} else {
-			break;
-		}
-	}
-
-	for (p = str; *p && isspace (*p); p++);
-
-	memmove(str, p, strlen (p) + 1);
-
-	return (strlen (str));
-}
-
-/**
- * get_options_stdin - get options from stdin
- * @zvm - Pointer to driver information
+ * set_option - store one option from the command line or stdin
+ * @ctx - Pointer to the options being parsed
+ * @id - Short option
+ * @arg - Option value
  *
  */
 static int
-get_options_stdin (zvm_driver_t *zvm)
+set_option(void *ctx, int id, const char *arg)
 {
-	char	buf[1024],
-		*endPtr,
-		*opt,
-		*arg;
-	int32_t lSrvName,
-		lTarget;
-	int	fence = 0;
-
-	while (fgets (buf, sizeof (buf), stdin) != 0) {
-		if (trim(buf) == 0) {
-			continue;
-		}
-		if (buf[0] == '#') {
-			continue;
-		}
-
-		opt = buf;
+	zvm_options_t *opts = ctx;
+	zvm_driver_t *zvm = opts->zvm;
+	char	*endPtr;
 
-		if ((arg = strchr(opt, '=')) != 0) {
-			*arg = 0;
-			arg++;
+	switch (id) {
+	case 'a' :
+		strncpy(zvm->smapiSrv, arg, sizeof(zvm->smapiSrv)-1);
+		break;
+	case 'n' :
+		strncpy(zvm->target, arg, sizeof(zvm->target)-1);
+		break;
+	case 'u' :
+		strncpy(zvm->authUser, arg, sizeof(zvm->authUser)-1);
+		break;
+	case 'p' :
+		strncpy(zvm->authPass, arg, sizeof(zvm->authPass)-1);
+		break;
+	case 'o' :
+		if (strcasecmp(arg, "off") == 0) {
+			opts->fence = 0;
+		} else if (strcasecmp(arg, "metadata") == 0) {
+			opts->fence = 1;
 		} else {
-			continue;
+			opts->fence = 2;
 		}
-
-		if (trim(arg) == 0)
-			continue;
-
-		if (!strcasecmp (opt, "action")) {
-			if (strcasecmp(arg, "off") == 0) {
-				fence = 0;
-			} else if (strcasecmp(arg, "metadata") == 0) {
-				fence = 1;
-			} else {
-				fence = 2;
-			}
-		} else if (!strcasecmp (opt, "ipaddr")) {
-			lSrvName = MIN(strlen(arg), sizeof(zvm->smapiSrv)-1);
-			memcpy(zvm->smapiSrv, arg, lSrvName);
-			continue;
-		} else if (!strcasecmp (opt, "login")) {
-			lSrvName = MIN(strlen(arg), sizeof(zvm->authUser)-1);
-			memcpy(zvm->authUser, arg, lSrvName);
-			continue;
-		} else if (!strcasecmp (opt, "passwd")) {
-			lSrvName = MIN(strlen(arg), sizeof(zvm->authPass)-1);
-			memcpy(zvm->authPass, arg, lSrvName);
-			continue;
-		} else if (!strcasecmp (opt, "port")) {
-			lTarget = MIN(strlen(arg), sizeof(zvm->target)-1);
-			strncpy(zvm->target, arg, lTarget);
-			continue;
-		} if (!strcasecmp (opt, "timeout")) {
-			zvm->timeOut = strtoul(arg, &endPtr, 10);
-			if (*endPtr != 0) {
-				syslog(LOG_WARNING, "Invalid timeout value specified %s "
-				       "defaulting to %d", 
-				       arg, DEFAULT_TIMEOUT);
-				zvm->timeOut = DEFAULT_TIMEOUT;
-			}
-		} else if (!strcasecmp (opt, "help")) {
-			fence = 2;
+		break;
+	case 't' :
+		zvm->timeOut = strtoul(arg, &endPtr, 10);
+		if (*endPtr != 0) {
+			syslog(LOG_WARNING, "Invalid timeout value specified: %s - "
+			       "defaulting to %d", 
+			       arg, DEFAULT_TIMEOUT);
+			zvm->timeOut = DEFAULT_TIMEOUT;
 		}
+		break;
+	default :
+		opts->fence = 2;
 	}
-	return(fence);
+	return(0);
 }
 
 /**
- * get_options - get options from the command line
+ * get_options - get options from the command line or, without
+ * arguments, from stdin
  * @argc - Count of arguments
  * @argv - Array of character strings
  * @zvm - Pointer to driver information
@@ -445,144 +430,18 @@ get_options_stdin (zvm_driver_t *zvm)
 static int
 get_options(int argc, char **argv, zvm_driver_t *zvm)
 {
-	int	c,
-		fence = 0;
-	int32_t	lSrvName,
-		lTarget;
-	char	*endPtr;
+	zvm_options_t opts;
 
-	while ((c = getopt_long(argc, argv, optString, longopts, NULL)) != -1) {
-		switch (c) {
-		case 'a' :
-			lSrvName = MIN(strlen(optarg), sizeof(zvm->smapiSrv)-1);
-			memcpy(zvm->smapiSrv, optarg, lSrvName);
-			break;
-		case 'n' :
-			lTarget = MIN(strlen(optarg), sizeof(zvm->target)-1);
-			memcpy(zvm->target, optarg, lTarget);
-			break;
-		case 'o' :
-			if (strcasecmp(optarg, "off") == 0) {
-				fence = 0;
-			} else if (strcasecmp(optarg, "metadata") == 0) {
-				fence = 1;
-			} else {
-				fence = 2;
-			}
-			break;
-		case 'p' :
-			lSrvName = MIN(strlen(optarg), 8);
-			memcpy(zvm->authPass, optarg, lSrvName);
-			break;
-		case 'u' :
-			lSrvName = MIN(strlen(optarg), 8);
-			memcpy(zvm->authUser, optarg, lSrvName);
-			break;
-		case 't' :
-			zvm->timeOut = strtoul(optarg, &endPtr, 10);
-			if (*endPtr != 0) {
-				syslog(LOG_WARNING, "Invalid timeout value specified: %s - "
-				       "defaulting to %d", 
-				       optarg, DEFAULT_TIMEOUT);
-				zvm->timeOut = DEFAULT_TIMEOUT;
-			}
-			break;
-		default :
-			fence = 2;
-		}
-	}
-	return(fence);
-}
+	opts.zvm = zvm;
+	opts.fence = 0;
 
-/**
- * zvm_metadata - Show fence metadata 
- * @self - Path to this executable
- *
- */
-static int
-zvm_metadata()
-{
-	fprintf (stdout, "<?xml version=\"1.0\" ?>\n");
-	fprintf (stdout, "<resource-agent name=\"fence_zvmip\"");
-	fprintf (stdout, " shortdesc=\"Fence agent for use with z/VM Virtual Machines\">\n");
-	fprintf (stdout, "<longdesc>");
-	fprintf (stdout, "The fence_zvm agent is intended to be used with with z/VM SMAPI service via TCP/IP");
-	fprintf (stdout, "</longdesc>\n");
-
-	fprintf (stdout, "<parameters>\n");
-
-	fprintf (stdout, "\t<parameter name=\"port\" unique=\"1\" required=\"1\">\n");
-	fprintf (stdout, "\t\t<getopt mixed=\"-n, --plug\" />\n");
-	fprintf (stdout, "\t\t<content type=\"string\" />\n");
-	fprintf (stdout, "\t\t<shortdesc lang=\"en\">%s</shortdesc>\n",
-	     "Name of the Virtual Machine to be fenced");
-	fprintf (stdout, "\t</parameter>\n");
-
-	fprintf (stdout, "\t<parameter name=\"ipaddr\" unique=\"1\" required=\"1\">\n");
-	fprintf (stdout, "\t\t<getopt mixed=\"-i, --ip\" />\n");
-	fprintf (stdout, "\t\t<content type=\"string\" />\n");
-	fprintf (stdout, "\t\t<shortdesc lang=\"en\">%s</shortdesc>\n",
-	     "IP Name or Address of SMAPI Server");
-	fprintf (stdout, "\t</parameter>\n");
-
-	fprintf (stdout, "\t<parameter name=\"login\" unique=\"1\" required=\"1\">\n");
-	fprintf (stdout, "\t\t<getopt mixed=\"-u, --username\" />\n");
-	fprintf (stdout, "\t\t<content type=\"string\" />\n");
-	fprintf (stdout, "\t\t<shortdesc lang=\"en\">%s</shortdesc>\n",
-	     "Name of authorized SMAPI user\n");
-	fprintf (stdout, "\t</parameter>\n");
-
-	fprintf (stdout, "\t<parameter name=\"passwd\" unique=\"1\" required=\"1\">\n");
-	fprintf (stdout, "\t\t<getopt mixed=\"-p, --password\" />\n");
-	fprintf (stdout, "\t\t<content type=\"string\" />\n");
-	fprintf (stdout, "\t\t<shortdesc lang=\"en\">%s</shortdesc>\n",
-	     "Password of authorized SMAPI user\n");
-	fprintf (stdout, "\t</parameter>\n");
-
-	fprintf (stdout, "\t<parameter name=\"action\" unique=\"1\" required=\"0\">\n");
-	fprintf (stdout, "\t\t<getopt mixed=\"-o, --action\" />\n");
-	fprintf (stdout, "\t\t<content type=\"string\" default=\"off\" />\n");
-	fprintf (stdout, "\t\t<shortdesc lang=\"en\">%s</shortdesc>\n",
-	     "Fencing action");
-	fprintf (stdout, "\t</parameter>\n");
-
-	fprintf (stdout, "\t<parameter name=\"usage\" unique=\"1\" required=\"0\">\n");
-	fprintf (stdout, "\t\t<getopt mixed=\"-h, --help\" />\n");
-	fprintf (stdout, "\t\t<content type=\"boolean\" />\n");
-	fprintf (stdout, "\t\t<shortdesc lang=\"en\">%s</shortdesc>\n",
-	     "Print usage");
-	fprintf (stdout, "\t</parameter>\n");
-
-	fprintf (stdout, "</parameters>\n");
-
-	fprintf (stdout, "<actions>\n");
-	fprintf (stdout, "\t<action name=\"off\" />\n");
-	fprintf (stdout, "\t<action name=\"metadata\" />\n");
-	fprintf (stdout, "</actions>\n");
-
-	fprintf (stdout, "</resource-agent>\n");
-
-	return(0);
-
-}
-
-/**
- * usage - display command syntax and parameters
- *
- */
-static int
-usage()
-{
-	fprintf(stderr,"Usage: fence_zvmip [options]\n\n"
-		"\tWhere [options] =\n"
-		"\t-o --action [action] - \"off\", \"metadata\"\n"
-		"\t-n --plug [target]   - Name of virtual machine to fence\n"
-		"\t-a --ip [server]     - IP Name/Address of SMAPI Server\n"
-		"\t-u --username [user] - Name of autorized SMAPI user\n"
-		"\t-p --password [pass] - Password of autorized SMAPI user\n"
-		"\t-t --timeout [secs]  - Time to wait for fence in seconds - currently ignored\n"
-		"\t-h --help            - Display this usage information\n");
-	return(1);
+	if (argc > 1) {
+		if (parse_opts_argv(&options_table, argc, argv, &opts) != 0)
+			opts.fence = 2;
+	} else {
+		parse_opts_stdin(&options_table, stdin, &opts);
+	}
+	return(opts.fence);
 }
 
 /**
@@ -630,10 +489,7 @@ main(int argc, char **argv)
 	memset(&zvm, 0, sizeof(zvm));
 	zvm.timeOut = DEFAULT_TIMEOUT;
 
-	if (argc > 1)
-		fence = get_options(argc, argv, &zvm);
-	else
-		fence = get_options_stdin(&zvm);
+	fence = get_options(argc, argv, &zvm);
 
 	switch(fence) {
 		case 0 :
@@ -641,10 +497,11 @@ main(int argc, char **argv)
 				rc = zvm_smapi_imageRecycle(&zvm);
 			break;
 		case 1 :
-			rc = zvm_metadata();
+			rc = print_opts_metadata(&options_table, argv[0]);
 			break;
 		case 2 :
-			rc = usage();
+			print_opts_usage(&options_table, argv[0], STDERR_FILENO);
+			rc = 1;
 	}
 	closelog();
 	return (rc);